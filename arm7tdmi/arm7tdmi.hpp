@@ -1,27 +1,97 @@
 #pragma once
 
 #include "../types.hpp"
+#include "../bus/concepts.hpp"
+#include "../scheduler/scheduler.hpp"
+#ifdef ARM7TDMI_TRACE_ACCESSES
+#include "../trace/accesstrace.hpp"
+#endif
+
+
+// Features picked at compile time. Cores with different policies can live in the same binary, so a frontend can run
+// ARM7TDMI<Bus, ARM7TDMIFastPolicy> and move over to ARM7TDMI<Bus, ARM7TDMIDebugPolicy> with loadState() once a debugger
+// attaches. ARM7TDMI_DISABLE_DEBUG and ARM7TDMI_DISABLE_FIQ only pick the default policy.
+struct ARM7TDMIDefaultPolicy {
+#ifdef ARM7TDMI_DISABLE_DEBUG
+	static constexpr bool debug = false;
+#else
+	static constexpr bool debug = true; // Breakpoints stop the core
+#endif
+#ifdef ARM7TDMI_DISABLE_FIQ
+	static constexpr bool fiq = false;
+#else
+	static constexpr bool fiq = true; // Otherwise FIQs are never taken and the F bit always reads as set
+#endif
+};
+
+struct ARM7TDMIFastPolicy {
+	static constexpr bool debug = false;
+	static constexpr bool fiq = ARM7TDMIDefaultPolicy::fiq;
+};
+
+struct ARM7TDMIDebugPolicy {
+	static constexpr bool debug = true;
+	static constexpr bool fiq = ARM7TDMIDefaultPolicy::fiq;
+};
 
-template <class T>
+template <class T, class Policy = ARM7TDMIDefaultPolicy>
 class ARM7TDMI {
 public:
 	T& bus;
-	bool processFiq;
-	bool processIrq;
+
+	// Everything that needs a look between instructions, packed so the hot loops only test pendingWork & pendingMask.
+	// The bus raises the interrupt lines by writing processFiq/processIrq as before. pendingMask only lets a line through
+	// while its interrupt is unmasked, so one that stays raised inside a handler doesn't keep the slow path on.
+	union {
+		struct {
+			bool processFiq;
+			bool processIrq;
+			bool halted; // Waiting for an interrupt, set through halt()
+			bool exitRequested;
+			bool breakpointsSet; // Any breakpoint exists
+			bool pendingUnused[3];
+		};
+		u64 pendingWork = 0;
+	};
+	static constexpr u64 PENDING_INTERRUPT_LINES = byteMask(0, 2); // processFiq and processIrq
+	static constexpr u64 PENDING_FIQ_LINE = byteMask(0, 1);
+	static constexpr u64 PENDING_IRQ_LINE = byteMask(1, 1);
+	u64 pendingMask = ~(u64)0;
+
+	// Has to be called after the I or F bit changes. setCPSR() and exception entry do it, anything else that writes
+	// the CPSR bits directly has to call it too.
+	void updatePendingMask() {
+		pendingMask = ~PENDING_INTERRUPT_LINES;
+		if (Policy::fiq && !reg.fiqDisable)
+			pendingMask |= PENDING_FIQ_LINE;
+		if (!reg.irqDisable)
+			pendingMask |= PENDING_IRQ_LINE;
+	}
 
 	/* User Functions */
+	// Breakpoints are one bit per address in 64KB bitmaps, found through a directory indexed by the top 8 address bits
+	// and a table for the next 8. Tables and bitmaps are only allocated once a breakpoint lands in them, so a core
+	// without breakpoints only carries the directory.
 	static constexpr std::size_t BMP_BITS = 16; // Thanks to BreadFish64 because I never would've come up with this breakpoint myself
-	static constexpr std::size_t TABLE_BITS = 32 - BMP_BITS;
+	static constexpr std::size_t DIR_BITS = 8;
+	static constexpr std::size_t TABLE_BITS = 32 - BMP_BITS - DIR_BITS;
 	static constexpr std::size_t BMP_SIZE = 1 << BMP_BITS;
 	static constexpr std::size_t TABLE_SIZE = 1 << TABLE_BITS;
+	static constexpr std::size_t DIR_SIZE = 1 << DIR_BITS;
 	static constexpr std::size_t BMP_MASK = BMP_SIZE - 1;
-	std::vector<std::unique_ptr<std::bitset<BMP_SIZE>>> breakpointsTable;
+	using BreakpointBitmap = std::bitset<BMP_SIZE>;
+	using BreakpointTable = std::array<std::unique_ptr<BreakpointBitmap>, TABLE_SIZE>;
+	std::array<std::unique_ptr<BreakpointTable>, DIR_SIZE> breakpointsTable;
 
-	ARM7TDMI(T& bus) : bus(bus), breakpointsTable(TABLE_SIZE){};
+	ARM7TDMI(T& bus) : bus(bus), codePagesTable(CODE_TABLE_SIZE) {
+		static_assert(ARM7TDMIBus<T>, "The bus doesn't implement the interface in bus/concepts.hpp");
+	};
 
 	void resetARM7TDMI()  {
 		processFiq = false;
 		processIrq = false;
+		halted = false;
+		exitRequested = false;
 
 		reg.R[0] = 0x00000000;
 		reg.R[1] = 0x00000000;
@@ -40,7 +110,7 @@ public:
 		reg.R[14] = 0x00000000;
 		reg.R[15] = 0x00000000;
 
-		reg.CPSR = 0x000000D3;
+		setCPSR(0x000000D3);
 
 		for (int i = 0; i < 8; i++) reg.R_usr[i] = 0x00000000;
 		for (int i = 0; i < 8; i++) reg.R_fiq[i] = 0x00000000;
@@ -49,51 +119,287 @@ public:
 		for (int i = 0; i < 8; i++) reg.R_irq[i] = 0x00000000;
 		for (int i = 0; i < 8; i++) reg.R_und[i] = 0x00000000;
 
+		idleLoop.tracking = false;
+		codeRegion.size = 0;
+		pendingCycles = 0;
 		flushPipeline();
 	}
 
-	void cycle() {
-#ifndef ARM7TDMI_DISABLE_FIQ
-		if(processFiq && !reg.fiqDisable) { [[unlikely]] // Service fast interrupt
-				serviceFiq();
-		} else
+	// Carries on from where other stopped, on the same bus. This is how a running session moves from a Fast instance
+	// to a Debug one when a debugger attaches (and back when it detaches): other has to be stopped, and shouldn't run
+	// again until it gets the state back. Breakpoints stay with the instance they were added to.
+	template <class OtherPolicy>
+	void loadState(ARM7TDMI<T, OtherPolicy>& other) {
+		static_assert(Policy::fiq == OtherPolicy::fiq, "Both instances need the same FIQ support");
+
+		other.flushPendingCycles();
+		reg = std::bit_cast<decltype(reg)>(other.reg);
+		updatePendingMask();
+		pipelineOpcode1 = other.pipelineOpcode1;
+		pipelineOpcode2 = other.pipelineOpcode2;
+		pipelineOpcode3 = other.pipelineOpcode3;
+		nextFetchType = other.nextFetchType;
+
+		processFiq = other.processFiq;
+		processIrq = other.processIrq;
+		halted = other.halted;
+		exitRequested = false;
+#ifdef ARM7TDMI_LOCAL_CYCLES
+		cycles = other.cycles;
+		cycleDeadline = other.cycleDeadline;
+		regionTiming = other.regionTiming;
 #endif
-		if (processIrq && !reg.irqDisable) { [[unlikely]] // Service interrupt
-				serviceIrq();
-		} else {
-			if (reg.thumbMode) {
-				u16 lutIndex = pipelineOpcode3 >> 6;
-				(this->*thumbLUT[lutIndex])((u16)pipelineOpcode3);
+#ifdef ARM7TDMI_FASTMEM
+		for (std::size_t i = 0; i < fastmemTable.size(); i++) {
+			if (other.fastmemTable[i]) {
+				fastmemTable[i] = std::make_unique<std::array<FastmemPage, 256>>(std::bit_cast<std::array<FastmemPage, 256>>(*other.fastmemTable[i]));
 			} else {
-				if (checkCondition(pipelineOpcode3 >> 28)) {
-					u32 lutIndex = ((pipelineOpcode3 & 0x0FF00000) >> 16) | ((pipelineOpcode3 & 0x000000F0) >> 4);
-					(this->*armLUT[lutIndex])(pipelineOpcode3);
+				fastmemTable[i].reset();
+			}
+		}
+#endif
+#ifdef ARM7TDMI_TRACE_ACCESSES
+		accessTrace = other.accessTrace;
+#endif
+
+		idleLoop.tracking = false;
+		codeRegion.size = 0;
+		pendingCycles = 0;
+		for (auto& bitmap : codePagesTable)
+			bitmap.reset();
+	}
+
+	void cycle() {
+		if (pendingWork & pendingMask) [[unlikely]] {
+			if (halted) {
+				if (processFiq || processIrq) {
+					halted = false;
 				} else {
-					fetchOpcode();
+					return;
 				}
 			}
+
+			exitRequested = false; // Only runUntil() acts on it
+			stepInstruction();
+			checkBreakpoint();
+		} else {
+			executeInstruction();
 		}
+		flushPendingCycles();
+		checkDeadline();
+	}
+
+	enum runExitReason {
+		EXIT_PREDICATE,
+		EXIT_INTERRUPT, // An interrupt line changed
+		EXIT_BREAKPOINT,
+		EXIT_REQUESTED, // requestExit() was called
+		EXIT_HALTED
+	};
+	runExitReason runExit;
+	bool runFiqLine;
+	bool runIrqLine;
+	u64 runPendingWork; // pendingWork as long as nothing happens
+
+	// Can be called from bus callbacks to make runUntil()/runFor() return after the current instruction
+	void requestExit() { exitRequested = true; }
+
+	// Runs instructions back to back until predicate() returns true, without returning to the caller in between
+	template <typename Predicate>
+	runExitReason runUntil(Predicate predicate) {
+		runFiqLine = processFiq;
+		runIrqLine = processIrq;
+		exitRequested = false;
+		runPendingWork = pendingWork & PENDING_INTERRUPT_LINES;
+
+		// Halting while running goes through exitRequested, so this only has to be looked at once
+		if (halted) [[unlikely]] {
+			if (processFiq || processIrq) {
+				halted = false;
+			} else {
+				flushPendingCycles();
+				return predicate() ? EXIT_PREDICATE : EXIT_HALTED;
+			}
+		}
+
+		while (!predicate()) {
+			stepInstruction();
+			if (checkRunExit()) [[unlikely]] {
+				flushPendingCycles();
+				return runExit;
+			}
+		}
+
+		flushPendingCycles();
+		return EXIT_PREDICATE;
+	}
+
+	// Checked after every instruction inside runUntil()
+	bool checkRunExit() {
+		checkDeadline();
+		if (pendingWork == runPendingWork) [[likely]]
+			return false;
 
-#ifndef ARM7TDMI_DISABLE_DEBUG
-		u32 nextInstrAddress = reg.R[15] - (reg.thumbMode ? 4 : 8);
-		// Again, this is too smart for me
-		if (const auto& breakpointBitmap = breakpointsTable[nextInstrAddress >> BMP_BITS];
-			breakpointBitmap && breakpointBitmap->test(nextInstrAddress & BMP_MASK)) { [[unlikely]]
-			bus.breakpoint();
+		if (checkBreakpoint()) [[unlikely]] {
+			runExit = EXIT_BREAKPOINT;
+			return true;
 		}
+		if (exitRequested) [[unlikely]] {
+			runExit = halted ? EXIT_HALTED : EXIT_REQUESTED;
+			return true;
+		}
+		if (Policy::fiq && (processFiq != runFiqLine)) [[unlikely]] {
+			runExit = EXIT_INTERRUPT;
+			return true;
+		}
+		if (processIrq != runIrqLine) [[unlikely]] {
+			runExit = EXIT_INTERRUPT;
+			return true;
+		}
+		return false;
+	}
+
+	// Runs until at least the given number of cycles have passed. Needs the bus to provide u64 cycleCount() unless ARM7TDMI_LOCAL_CYCLES is set.
+	// Time spent halted is skipped in one go, EXIT_HALTED means the core was still asleep when the time ran out.
+	runExitReason runFor(u64 cycles) {
+		u64 endCycle = currentCycle() + cycles;
+		while (true) {
+			runExitReason reason = runUntil([&]() { return currentCycle() >= endCycle; });
+			if (reason != EXIT_HALTED)
+				return reason;
+
+			skipHalted(endCycle);
+			if (sleeping())
+				return EXIT_HALTED;
+		}
+	}
+
+	// Stops the core until processIrq or processFiq is raised, even if interrupts are disabled. Can be called from bus
+	// callbacks, runUntil() returns EXIT_HALTED after the current instruction.
+	void halt() {
+		halted = true;
+		exitRequested = true;
+	}
+
+	// True if nothing will run until an interrupt line is raised
+	bool sleeping() {
+		return halted && !processFiq && !processIrq;
+	}
+
+	// Moves the clock up to target while sleeping, in one step (with ARM7TDMI_LOCAL_CYCLES, one per deadline so the bus
+	// can raise an interrupt in between)
+	void skipHalted(u64 target) {
+#ifdef ARM7TDMI_LOCAL_CYCLES
+		while (sleeping() && (cycles < target)) {
+			cycles = (cycleDeadline > cycles) ? std::min(cycleDeadline, target) : target;
+			checkDeadline();
+		}
+#else
+		u64 now = currentCycle();
+		if (sleeping() && (target > now))
+			bus.iCycle(target - now);
+#endif
+	}
+
+	// The core's clock, in the same units as runFor()
+	u64 currentCycle() {
+#ifdef ARM7TDMI_LOCAL_CYCLES
+		return cycles;
+#else
+		flushPendingCycles();
+		return bus.cycleCount();
 #endif
 	}
 
+	// Runs until the clock reaches endCycle, stopping at every event's timestamp to let the scheduler run it. Events
+	// scheduled from bus callbacks while running are picked up right away, and IRQ/FIQ lines raised by event callbacks
+	// are seen before the next instruction. Returns early on breakpoints and requestExit().
+	runExitReason runScheduled(Scheduler& scheduler, u64 endCycle) {
+		while (true) {
+			u64 now = currentCycle();
+			scheduler.runEvents(now);
+			if (now >= endCycle)
+				return EXIT_PREDICATE;
+
+			runExitReason reason = runUntil([&]() { return currentCycle() >= std::min(scheduler.nextEventTime(), endCycle); });
+			if ((reason == EXIT_BREAKPOINT) || (reason == EXIT_REQUESTED))
+				return reason;
+			if (reason == EXIT_HALTED) { // Nothing happens until an event wakes the core up
+				u64 target = std::min(scheduler.nextEventTime(), endCycle);
+				if (sleeping() && (target == Scheduler::NEVER))
+					return EXIT_HALTED;
+				skipHalted(target);
+			}
+		}
+	}
+
+	void stepInstruction() {
+		if (pendingWork & pendingMask) [[unlikely]] {
+			if (Policy::fiq && processFiq && !reg.fiqDisable) { // Service fast interrupt
+				serviceFiq();
+				return;
+			}
+			if (processIrq && !reg.irqDisable) { // Service interrupt
+				serviceIrq();
+				return;
+			}
+		}
+
+		executeInstruction();
+	}
+
+	bool interruptPending() {
+		if (!(pendingWork & pendingMask)) [[likely]]
+			return false;
+		if (Policy::fiq && processFiq && !reg.fiqDisable)
+			return true;
+		return processIrq && !reg.irqDisable;
+	}
+
+	// Returns true if execution should stop because a breakpoint was hit
+	bool checkBreakpoint() {
+		if constexpr (Policy::debug) {
+			if (!breakpointsSet) [[likely]]
+				return false;
+
+			u32 nextInstrAddress = reg.R[15] - (reg.thumbMode ? 4 : 8);
+			// Again, this is too smart for me
+			if (const BreakpointBitmap *breakpointBitmap = findBreakpointBitmap(nextInstrAddress);
+				breakpointBitmap && breakpointBitmap->test(nextInstrAddress & BMP_MASK)) { [[unlikely]]
+				bus.breakpoint();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	BreakpointBitmap *findBreakpointBitmap(u32 address) {
+		const auto& table = breakpointsTable[address >> (BMP_BITS + TABLE_BITS)];
+		return table ? (*table)[(address >> BMP_BITS) & (TABLE_SIZE - 1)].get() : nullptr;
+	}
+
+	// Any instance keeps breakpoints, only ones with Policy::debug stop on them
 	void addBreakpoint(u32 address) {
-		auto& page = breakpointsTable[address >> BMP_BITS];
+		auto& table = breakpointsTable[address >> (BMP_BITS + TABLE_BITS)];
+		if (!table) {
+			table = std::make_unique<BreakpointTable>();
+		}
+
+		auto& page = (*table)[(address >> BMP_BITS) & (TABLE_SIZE - 1)];
 		if (!page) {
-			page = std::make_unique<std::bitset<BMP_SIZE>>();
+			page = std::make_unique<BreakpointBitmap>();
 		}
 		page->set(address & BMP_MASK);
+		breakpointsSet = Policy::debug;
 	}
 
 	void removeBreakpoint(u32 address) {
-		auto& page = breakpointsTable[address >> BMP_BITS];
+		auto& table = breakpointsTable[address >> (BMP_BITS + TABLE_BITS)];
+		if (!table) {
+			return;
+		}
+
+		auto& page = (*table)[(address >> BMP_BITS) & (TABLE_SIZE - 1)];
 		if (!page) {
 			return;
 		}
@@ -101,6 +407,10 @@ public:
 		page->reset(address & BMP_MASK);
 		if (page->none()) {
 			page.reset();
+			if (std::none_of(table->begin(), table->end(), [](const auto& bitmap) { return (bool)bitmap; })) {
+				table.reset();
+				breakpointsSet = Policy::debug && std::any_of(breakpointsTable.begin(), breakpointsTable.end(), [](const auto& table) { return (bool)table; });
+			}
 		}
 	}
 
@@ -124,25 +434,102 @@ public:
 				u32 thumbMode : 1;
 				u32 fiqDisable : 1;
 				u32 irqDisable : 1;
-				u32 : 20;
-				u32 flagV : 1;
-				u32 flagC : 1;
-				u32 flagZ : 1;
-				u32 flagN : 1;
 			};
-			u32 CPSR;
+			u32 controlBits; // CPSR without NZCV, use getCPSR() and setCPSR() for the whole register
 		};
 
-		// Banked registers for each mode
-		// Indexes 0-6 are R8-R14, 7 is SPSR
-		u32 R_usr[8];
-		u32 R_fiq[8];
-		u32 R_svc[8];
-		u32 R_abt[8];
-		u32 R_irq[8];
-		u32 R_und[8];
+		// Condition flags live outside the CPSR word so they can be set without a read-modify-write
+		bool flagN;
+		bool flagZ;
+		bool flagC;
+		bool flagV;
+
+		// Banked registers for each mode, indexed by modeBank[]
+		// Indexes 0-6 are R8-R14, 7 is SPSR. The slots of the current mode are stale until it is left.
+		union {
+			u32 R_bank[6][8];
+			struct {
+				u32 R_usr[8]; // Also used by system mode, and holds R8-R12 for every mode except FIQ
+				u32 R_fiq[8];
+				u32 R_svc[8];
+				u32 R_abt[8];
+				u32 R_irq[8];
+				u32 R_und[8];
+			};
+		};
 	} reg;
 
+	enum registerBank : i8 {
+		BANK_INVALID = -1,
+		BANK_USR,
+		BANK_FIQ,
+		BANK_SVC,
+		BANK_ABT,
+		BANK_IRQ,
+		BANK_UND
+	};
+	static constexpr std::array<registerBank, 32> modeBank = [] {
+		std::array<registerBank, 32> table;
+		table.fill(BANK_INVALID);
+		table[MODE_USER] = BANK_USR;
+		table[MODE_FIQ] = BANK_FIQ;
+		table[MODE_IRQ] = BANK_IRQ;
+		table[MODE_SUPERVISOR] = BANK_SVC;
+		table[MODE_ABORT] = BANK_ABT;
+		table[MODE_UNDEFINED] = BANK_UND;
+		table[MODE_SYSTEM] = BANK_USR;
+		return table;
+	}();
+
+	// SPSR of the current mode, nullptr in user and system mode
+	u32 *currentSPSR() {
+		registerBank bank = modeBank[reg.mode];
+		return (bank > BANK_USR) ? &reg.R_bank[bank][7] : nullptr;
+	}
+
+	u32 getCPSR() {
+		return reg.controlBits | ((u32)reg.flagN << 31) | ((u32)reg.flagZ << 30) | ((u32)reg.flagC << 29) | ((u32)reg.flagV << 28);
+	}
+
+	void setCPSR(u32 value) {
+		reg.controlBits = value & 0x0FFFFFFF;
+		reg.flagN = (value >> 31) & 1;
+		reg.flagZ = (value >> 30) & 1;
+		reg.flagC = (value >> 29) & 1;
+		reg.flagV = (value >> 28) & 1;
+		updatePendingMask();
+	}
+
+	/* Flags */
+	// Sets all of NZCV
+	void setFlags(u32 result, bool carry, bool overflow) {
+		reg.flagN = result >> 31;
+		reg.flagZ = result == 0;
+		reg.flagC = carry;
+		reg.flagV = overflow;
+	}
+
+	// N and Z from the result, V is left alone
+	void setFlagsLogical(u32 result, bool carry) {
+		reg.flagN = result >> 31;
+		reg.flagZ = result == 0;
+		reg.flagC = carry;
+	}
+
+	// N and Z from the result, C and V are left alone
+	void setFlagsNZ(u32 result) {
+		reg.flagN = result >> 31;
+		reg.flagZ = result == 0;
+	}
+
+	void setFlagsAdd(u32 operand1, u32 operand2, u32 result) {
+		setFlags(result, result < operand1, (~(operand1 ^ operand2) & (operand1 ^ result)) >> 31);
+	}
+
+	void setFlagsSub(u32 operand1, u32 operand2, u32 result) {
+		setFlags(result, operand1 >= operand2, ((operand1 ^ operand2) & (operand1 ^ result)) >> 31);
+	}
+
 	/* Instruction Fetch/Decode */
 	u32 pipelineOpcode1; // R15
 	u32 pipelineOpcode2; // R15 + 4
@@ -184,6 +571,7 @@ public:
 		reg.irqDisable = true;
 		reg.fiqDisable = true;
 		reg.thumbMode = false;
+		updatePendingMask();
 
 		reg.R[15] = 0x0000001C;
 		flushPipeline();
@@ -200,25 +588,114 @@ public:
 		reg.irqDisable = true;
 		reg.fiqDisable = true;
 		reg.thumbMode = false;
+		updatePendingMask();
 
 		reg.R[15] = 0x00000018;
 		flushPipeline();
 	}
 
+	void executeInstruction() {
+		if (reg.thumbMode) {
+			u16 lutIndex = pipelineOpcode3 >> 6;
+			(this->*thumbLUT[lutIndex])((u16)pipelineOpcode3);
+		} else {
+			if (checkCondition(pipelineOpcode3 >> 28)) {
+				u32 lutIndex = ((pipelineOpcode3 & 0x0FF00000) >> 16) | ((pipelineOpcode3 & 0x000000F0) >> 4);
+				(this->*armLUT[lutIndex])(pipelineOpcode3);
+			} else {
+				fetchOpcode();
+			}
+		}
+	}
+
+	// Opcode fetches go through here. Sequential fetches inside the bus's current FetchRegion skip bus.read()
+	// and have their cycles handed to bus.iCycle() in bulk, before the next bus access or when the run returns.
+	static constexpr bool directFetch() {
+		return requires (T& b, u32 address, FetchRegion& region) {
+			{ b.fetchRegion(address, region) } -> std::convertible_to<bool>;
+		};
+	}
+
+	// True if some accesses are timed by the core and have to be handed to the bus later
+	static constexpr bool deferCycles() {
+#if defined(ARM7TDMI_LOCAL_CYCLES)
+		return false;
+#elif defined(ARM7TDMI_FASTMEM)
+		return true;
+#else
+		return directFetch();
+#endif
+	}
+
+	FetchRegion codeRegion;
+	u32 pendingCycles;
+
+	template <typename TT> TT fetchCode(u32 address, bool sequential) {
+		if constexpr (trackCodePages()) {
+			if (!sequential || !(address & CODE_PAGE_MASK))
+				markCodePage(address);
+		}
+		if constexpr (directFetch()) {
+			u32 offset = address - codeRegion.start;
+			if (offset < codeRegion.size) [[likely]] {
+				if (sequential) [[likely]] {
+					TT opcode;
+					memcpy(&opcode, codeRegion.memory + offset, sizeof(TT));
+					directAccessCycles<TT>(address, true, (sizeof(TT) == 2) ? codeRegion.cycles16 : codeRegion.cycles32);
+					return opcode;
+				}
+			} else {
+				flushPendingCycles();
+				if (!bus.fetchRegion(address, codeRegion))
+					codeRegion.size = 0;
+			}
+		}
+		accessCycles<TT>(address, sequential);
+		return bus.template read<TT, true>(address, sequential);
+	}
+
+	void flushPendingCycles() {
+		if constexpr (deferCycles()) {
+			if (pendingCycles) {
+				bus.iCycle(pendingCycles);
+				pendingCycles = 0;
+			}
+		}
+	}
+
+	// Has to be called by the bus when memory behind the current FetchRegion is remapped
+	void invalidateFetchRegion() {
+		flushPendingCycles();
+		codeRegion.size = 0;
+	}
+
+	// With ARM7TDMI_PIPELINE_FREE only the opcode that runs next is fetched, and flushes take one read instead of two.
+	// R15 still reads as PC + 8/PC + 4, but stores into the next two instructions are seen right away and code fetch
+	// timing no longer matches the hardware.
 	void fetchOpcode() {
+#ifdef ARM7TDMI_PIPELINE_FREE
+		if (reg.thumbMode) {
+			reg.R[15] += 2;
+			pipelineOpcode3 = fetchCode<u16>(reg.R[15] - 4, nextFetchType);
+		} else {
+			reg.R[15] += 4;
+			pipelineOpcode3 = fetchCode<u32>(reg.R[15] - 8, nextFetchType);
+		}
+#else
 		if (reg.thumbMode) {
-			pipelineOpcode1 = bus.template read<u16, true>(reg.R[15], nextFetchType);
+			pipelineOpcode1 = fetchCode<u16>(reg.R[15], nextFetchType);
 			pipelineOpcode3 = pipelineOpcode2;
 			pipelineOpcode2 = pipelineOpcode1;
 
 			reg.R[15] += 2;
 		} else {
-			pipelineOpcode1 = bus.template read<u32, true>(reg.R[15], nextFetchType);
+			pipelineOpcode1 = fetchCode<u32>(reg.R[15], nextFetchType);
 			pipelineOpcode3 = pipelineOpcode2;
 			pipelineOpcode2 = pipelineOpcode1;
 
 			reg.R[15] += 4;
 		}
+#endif
 
 		nextFetchType = true;
 	}
@@ -226,12 +703,16 @@ public:
 	void flushPipeline() {
 		if (reg.thumbMode) {
 			reg.R[15] = (reg.R[15] & ~1) + 4;
-			pipelineOpcode3 = bus.template read<u16, true>(reg.R[15] - 4, false);
-			pipelineOpcode2 = bus.template read<u16, true>(reg.R[15] - 2, true);
+			pipelineOpcode3 = fetchCode<u16>(reg.R[15] - 4, false);
+#ifndef ARM7TDMI_PIPELINE_FREE
+			pipelineOpcode2 = fetchCode<u16>(reg.R[15] - 2, true);
+#endif
 		} else {
 			reg.R[15] = (reg.R[15] & ~3) + 8;
-			pipelineOpcode3 = bus.template read<u32, true>(reg.R[15] - 8, false);
-			pipelineOpcode2 = bus.template read<u32, true>(reg.R[15] - 4, true);
+			pipelineOpcode3 = fetchCode<u32>(reg.R[15] - 8, false);
+#ifndef ARM7TDMI_PIPELINE_FREE
+			pipelineOpcode2 = fetchCode<u32>(reg.R[15] - 4, true);
+#endif
 		}
 
 		nextFetchType = true;
@@ -257,6 +738,113 @@ public:
 	}
 
 	/* Helper Functions */
+	// LDM/STM/PUSH/POP try these first. They return false when the bus has no readBlock()/writeBlock() hooks or
+	// refuses the range (e.g. it crosses into another region), and the caller falls back to one access per register.
+	static constexpr bool blockTransfers() {
+		return requires (T& b, u32 address, u32 *values, const u32 *constValues, int count) {
+			{ b.readBlock(address, values, count) } -> std::convertible_to<bool>;
+			{ b.writeBlock(address, constValues, count) } -> std::convertible_to<bool>;
+		};
+	}
+
+	bool dataReadBlock(u32 address, u32 *values, int count) {
+		if constexpr (blockTransfers()) {
+			flushPendingCycles();
+			if constexpr (detectIdleLoops())
+				idleLoop.tracking = false;
+			if (!bus.readBlock(address, values, count))
+				return false;
+#ifdef ARM7TDMI_TRACE_ACCESSES
+			for (int i = 0; i < count; i++)
+				traceAccess(address + (i * 4), values[i], 4, false);
+#endif
+			blockCycles(address, count);
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+	bool dataWriteBlock(u32 address, const u32 *values, int count) {
+		if constexpr (blockTransfers()) {
+			flushPendingCycles();
+			if constexpr (detectIdleLoops())
+				idleLoop.tracking = false;
+			if (!bus.writeBlock(address, values, count))
+				return false;
+#ifdef ARM7TDMI_TRACE_ACCESSES
+			for (int i = 0; i < count; i++)
+				traceAccess(address + (i * 4), values[i], 4, true);
+#endif
+#ifdef ARM7TDMI_SMC_CHECK
+			codeWritten(address, count * 4);
+#endif
+			blockCycles(address, count);
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+	// All data accesses made by instructions go through these so the core can watch them
+	template <typename TT> TT dataRead(u32 address, bool sequential) {
+		TT value = memoryRead<TT>(address, sequential);
+#ifdef ARM7TDMI_TRACE_ACCESSES
+		traceAccess(address, value, sizeof(TT), false);
+#endif
+		return value;
+	}
+
+	template <typename TT> void dataWrite(u32 address, TT value, bool sequential) {
+#ifdef ARM7TDMI_TRACE_ACCESSES
+		traceAccess(address, value, sizeof(TT), true);
+#endif
+		memoryWrite<TT>(address, value, sequential);
+	}
+
+	template <typename TT> TT memoryRead(u32 address, bool sequential) {
+		if constexpr (detectIdleLoops()) {
+			if (idleLoop.tracking && !bus.isVolatile(address))
+				idleLoop.tracking = false;
+		}
+#ifdef ARM7TDMI_FASTMEM
+		if (const auto& pages = fastmemTable[address >> 20]) {
+			FastmemPage& page = (*pages)[(address >> FASTMEM_PAGE_BITS) & 0xFF];
+			if (page.read) {
+				TT value;
+				memcpy(&value, page.read + (address & FASTMEM_PAGE_MASK & ~(sizeof(TT) - 1)), sizeof(TT));
+				directAccessCycles<TT>(address, sequential, timingCycles<TT>(page.timing, sequential));
+				return value;
+			}
+		}
+#endif
+		flushPendingCycles();
+		accessCycles<TT>(address, sequential);
+		return bus.template read<TT, false>(address, sequential);
+	}
+
+	template <typename TT> void memoryWrite(u32 address, TT value, bool sequential) {
+		if constexpr (detectIdleLoops())
+			idleLoop.tracking = false;
+#ifdef ARM7TDMI_SMC_CHECK
+		if (isCodePage(address)) [[unlikely]]
+			codeWritten(address, sizeof(TT));
+#endif
+#ifdef ARM7TDMI_FASTMEM
+		if (const auto& pages = fastmemTable[address >> 20]) {
+			FastmemPage& page = (*pages)[(address >> FASTMEM_PAGE_BITS) & 0xFF];
+			if (page.write) {
+				memcpy(page.write + (address & FASTMEM_PAGE_MASK & ~(sizeof(TT) - 1)), &value, sizeof(TT));
+				directAccessCycles<TT>(address, sequential, timingCycles<TT>(page.timing, sequential));
+				return;
+			}
+		}
+#endif
+		flushPendingCycles();
+		accessCycles<TT>(address, sequential);
+		bus.template write<TT>(address, value, sequential);
+	}
+
 	template <typename TT> u32 rotateMisaligned(TT value, u32 address) {
 		return std::rotr((u32)value, (address & (sizeof(TT) - 1)) * 8);
 	}
@@ -358,88 +946,43 @@ public:
 	}
 
 	void bankRegisters(cpuMode newMode, bool enterMode) {
-		u32 *currentModeBank = nullptr;
-		switch (reg.mode) {
-		case MODE_SYSTEM:
-		case MODE_USER: currentModeBank = reg.R_usr; break;
-		case MODE_FIQ: currentModeBank = reg.R_fiq; break;
-		case MODE_IRQ: currentModeBank = reg.R_irq; break;
-		case MODE_SUPERVISOR: currentModeBank = reg.R_svc; break;
-		case MODE_ABORT: currentModeBank = reg.R_abt; break;
-		case MODE_UNDEFINED: currentModeBank = reg.R_und; break;
-		}
-
-		u32 *newModeBank = nullptr;
-		switch (newMode) {
-		case MODE_SYSTEM:
-		case MODE_USER: newModeBank = reg.R_usr; break;
-		case MODE_FIQ: newModeBank = reg.R_fiq; break;
-		case MODE_IRQ: newModeBank = reg.R_irq; break;
-		case MODE_SUPERVISOR: newModeBank = reg.R_svc; break;
-		case MODE_ABORT: newModeBank = reg.R_abt; break;
-		case MODE_UNDEFINED: newModeBank = reg.R_und; break;
-		default:
+		registerBank currentBank = modeBank[reg.mode];
+		registerBank newBank = modeBank[newMode];
+		if (newBank == BANK_INVALID) {
 			printf("Invalid mode 0x%02X\n", newMode);
 			bus.log << fmt::format("Invalid mode 0x{:0>2X}\n", (int)newMode);
 			bus.hacf();
 			return;
 		}
 
-		// Save current bank
-		if (reg.mode == MODE_FIQ) {
-			reg.R_fiq[0] = reg.R[8];
-			reg.R_fiq[1] = reg.R[9];
-			reg.R_fiq[2] = reg.R[10];
-			reg.R_fiq[3] = reg.R[11];
-			reg.R_fiq[4] = reg.R[12];
-		} else { // User mode R8-R12 stores whatever was in R8-R12 so any mode can be switched to from fiq
-			reg.R_usr[0] = reg.R[8];
-			reg.R_usr[1] = reg.R[9];
-			reg.R_usr[2] = reg.R[10];
-			reg.R_usr[3] = reg.R[11];
-			reg.R_usr[4] = reg.R[12];
-		}
-		currentModeBank[5] = reg.R[13];
-		currentModeBank[6] = reg.R[14];
-
-		// Load new bank
-		if (newMode == MODE_FIQ) {
-			reg.R[8] = reg.R_fiq[0];
-			reg.R[9] = reg.R_fiq[1];
-			reg.R[10] = reg.R_fiq[2];
-			reg.R[11] = reg.R_fiq[3];
-			reg.R[12] = reg.R_fiq[4];
-		} else {
-			reg.R[8] = reg.R_usr[0];
-			reg.R[9] = reg.R_usr[1];
-			reg.R[10] = reg.R_usr[2];
-			reg.R[11] = reg.R_usr[3];
-			reg.R[12] = reg.R_usr[4];
+		// R8-R12 only need to move when entering or leaving FIQ mode
+		if ((currentBank == BANK_FIQ) != (newBank == BANK_FIQ)) {
+			memcpy(reg.R_bank[currentBank == BANK_FIQ ? BANK_FIQ : BANK_USR], &reg.R[8], 5 * sizeof(u32));
+			memcpy(&reg.R[8], reg.R_bank[newBank == BANK_FIQ ? BANK_FIQ : BANK_USR], 5 * sizeof(u32));
+		}
+		if (currentBank != newBank) {
+			reg.R_bank[currentBank][5] = reg.R[13];
+			reg.R_bank[currentBank][6] = reg.R[14];
+			reg.R[13] = reg.R_bank[newBank][5];
+			reg.R[14] = reg.R_bank[newBank][6];
 		}
-		reg.R[13] = newModeBank[5];
-		reg.R[14] = newModeBank[6];
 
 		// Save SPSR and set new CPSR
 		if (enterMode) {
-			if (newMode != MODE_SYSTEM && newMode != MODE_USER)
-				newModeBank[7] = reg.CPSR;
-			reg.CPSR = (reg.CPSR & ~0x3F) | newMode;
+			if (newBank != BANK_USR)
+				reg.R_bank[newBank][7] = getCPSR();
+			reg.controlBits = (reg.controlBits & ~0x3F) | newMode;
 		}
 	}
 
 	void leaveMode() {
-		u32 tmpPSR = reg.CPSR;
-		switch (reg.mode) {
-		case MODE_FIQ: tmpPSR = reg.R_fiq[7]; break;
-		case MODE_IRQ: tmpPSR = reg.R_irq[7]; break;
-		case MODE_SUPERVISOR: tmpPSR = reg.R_svc[7]; break;
-		case MODE_ABORT: tmpPSR = reg.R_abt[7]; break;
-		case MODE_UNDEFINED: tmpPSR = reg.R_und[7]; break;
-		}
-		bankRegisters((cpuMode)(tmpPSR & 0x1F), false);
-		reg.CPSR = tmpPSR;
+		u32 *spsr = currentSPSR();
+		u32 newPSR = spsr ? *spsr : getCPSR();
+		bankRegisters((cpuMode)(newPSR & 0x1F), false);
+		setCPSR(newPSR);
 	}
 
+
 	/* ARM instructions */
 	template <bool iBit, int operation, bool sBit> void dataProcessing(u32 opcode)  {
 		// Shift and rotate to get operands
@@ -453,8 +996,8 @@ public:
 		bool shifterCarry = computeShift<false, iBit>(opcode, &operand2);
 
 		// Perform operation
-		bool operationCarry = reg.flagC;
-		bool operationOverflow = reg.flagV;
+		bool operationCarry = false;
+		bool operationOverflow = false;
 		operand1 = reg.R[(opcode >> 16) & 0xF];
 		u32 result = 0;
 		auto destinationReg = (opcode & (0xF << 12)) >> 12;
@@ -466,19 +1009,13 @@ public:
 			result = operand1 ^ operand2;
 			break;
 		case 0x2: // SUB
-			operationCarry = operand1 >= operand2;
 			result = operand1 - operand2;
-			operationOverflow = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
 			break;
 		case 0x3: // RSB
-			operationCarry = operand2 >= operand1;
 			result = operand2 - operand1;
-			operationOverflow = ((operand2 ^ operand1) & ((operand2 ^ result)) & 0x80000000) > 0;
 			break;
 		case 0x4: // ADD
-			operationCarry = ((u64)operand1 + (u64)operand2) >> 32;
 			result = operand1 + operand2;
-			operationOverflow = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
 			break;
 		case 0x5: // ADC
 			operationCarry = ((u64)operand1 + (u64)operand2 + reg.flagC) >> 32;
@@ -502,14 +1039,10 @@ public:
 			result = operand1 ^ operand2;
 			break;
 		case 0xA: // CMP
-			operationCarry = operand1 >= operand2;
 			result = operand1 - operand2;
-			operationOverflow = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
 			break;
 		case 0xB: // CMN
-			operationCarry = ((u64)operand1 + (u64)operand2) >> 32;
 			result = operand1 + operand2;
-			operationOverflow = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
 			break;
 		case 0xC: // ORR
 			result = operand1 | operand2;
@@ -527,18 +1060,21 @@ public:
 
 		// Compute common flags
 		if constexpr (sBit) {
-			reg.flagN = result >> 31;
-			reg.flagZ = result == 0;
-			if ((operation < 2) || (operation == 8) || (operation == 9) || (operation >= 0xC)) { // Logical operations
-				reg.flagC = shifterCarry;
+			if constexpr ((operation < 2) || (operation == 8) || (operation == 9) || (operation >= 0xC)) { // Logical operations
+				setFlagsLogical(result, shifterCarry);
+			} else if constexpr ((operation == 0x2) || (operation == 0xA)) { // SUB, CMP
+				setFlagsSub(operand1, operand2, result);
+			} else if constexpr (operation == 0x3) { // RSB
+				setFlagsSub(operand2, operand1, result);
+			} else if constexpr ((operation == 0x4) || (operation == 0xB)) { // ADD, CMN
+				setFlagsAdd(operand1, operand2, result);
 			} else {
-				reg.flagC = operationCarry;
-				reg.flagV = operationOverflow;
+				setFlags(result, operationCarry, operationOverflow);
 			}
 		}
 
 		if (shiftReg) {
-			bus.iCycle(1); // TODO: Should probably be after setting register
+			internalCycles(1); // TODO: Should probably be after setting register
 		} else {
 			fetchOpcode();
 		}
@@ -566,17 +1102,15 @@ public:
 		u32 result = multiplier * reg.R[opcode & 0xF];
 		if constexpr (accumulate) {
 			result += reg.R[(opcode >> 12) & 0xF];
-			bus.iCycle(1);
+			internalCycles(1);
 		}
 		if (destinationReg != 15)
 			reg.R[destinationReg] = result;
-		if constexpr (sBit) {
-			reg.flagN = result >> 31;
-			reg.flagZ = result == 0;
-		}
+		if constexpr (sBit)
+			setFlagsNZ(result);
 
 		int multiplierCycles = ((31 - std::max(std::countl_zero(multiplier), std::countl_one(multiplier))) / 8) + 1;
-		bus.iCycle(multiplierCycles);
+		internalCycles(multiplierCycles);
 	}
 
 	template <bool signedMul, bool accumulate, bool sBit> void multiplyLong(u32 opcode) {
@@ -596,14 +1130,14 @@ public:
 		}
 		if constexpr (accumulate) {
 			result += ((u64)reg.R[destinationRegHigh] << 32) | (u64)reg.R[destinationRegLow];
-			bus.iCycle(1);
+			internalCycles(1);
 		}
 		if constexpr (sBit) {
 			reg.flagN = result >> 63;
 			reg.flagZ = result == 0;
 		}
 
-		bus.iCycle(multiplierCycles + 1);
+		internalCycles(multiplierCycles + 1);
 
 		if (destinationRegLow != 15)
 			reg.R[destinationRegLow] = result;
@@ -619,15 +1153,15 @@ public:
 		fetchOpcode();
 
 		if constexpr (byteWord) {
-			result = bus.template read<u8, false>(address, true);
-			bus.template write<u8>(address, (u8)reg.R[sourceRegister], false);
+			result = dataRead<u8>(address, true);
+			dataWrite<u8>(address, (u8)reg.R[sourceRegister], false);
 		} else {
-			result = rotateMisaligned(bus.template read<u32, false>(address, true), address);
-			bus.template write<u32>(address, reg.R[sourceRegister], false);
+			result = rotateMisaligned(dataRead<u32>(address, true), address);
+			dataWrite<u32>(address, reg.R[sourceRegister], false);
 		}
 
 		reg.R[destinationRegister] = result;
-		bus.iCycle(1);
+		internalCycles(1);
 
 		if (destinationRegister == 15) {
 			flushPipeline();
@@ -637,59 +1171,51 @@ public:
 	template <bool targetPSR> void psrLoad(u32 opcode) {
 		u32 destinationReg = (opcode >> 12) & 0xF;
 
-		if constexpr (targetPSR) {
-			switch (reg.mode) {
-			case MODE_FIQ: reg.R[destinationReg] = reg.R_fiq[7]; break;
-			case MODE_IRQ: reg.R[destinationReg] = reg.R_irq[7]; break;
-			case MODE_SUPERVISOR: reg.R[destinationReg] = reg.R_svc[7]; break;
-			case MODE_ABORT: reg.R[destinationReg] = reg.R_abt[7]; break;
-			case MODE_UNDEFINED: reg.R[destinationReg] = reg.R_und[7]; break;
-			default: reg.R[destinationReg] = reg.CPSR; break;
-			}
-		} else {
-			reg.R[destinationReg] = reg.CPSR;
-		}
+		u32 *spsr = targetPSR ? currentSPSR() : nullptr;
+		reg.R[destinationReg] = spsr ? *spsr : getCPSR();
 
 		fetchOpcode();
 	}
 
+
 	template <bool targetPSR> void psrStoreReg(u32 opcode) {
 		u32 operand = reg.R[opcode & 0xF];
 
-		u32 *target;
+		u32 *spsr;
+		u32 current;
 		if constexpr (targetPSR) {
-			switch (reg.mode) {
-			case MODE_FIQ: target = &reg.R_fiq[7]; break;
-			case MODE_IRQ: target = &reg.R_irq[7]; break;
-			case MODE_SUPERVISOR: target = &reg.R_svc[7]; break;
-			case MODE_ABORT: target = &reg.R_abt[7]; break;
-			case MODE_UNDEFINED: target = &reg.R_und[7]; break;
-			default:
+			spsr = currentSPSR();
+			if (!spsr) {
 				fetchOpcode();
 				return;
 			}
+			current = *spsr;
 		} else {
-			target = &reg.CPSR;
+			current = getCPSR();
 		}
 
 		u32 result = 0;
 		if (opcode & (1 << 19)) {
 			result |= operand & 0xF0000000;
 		} else {
-			result |= *target & 0xF0000000;
+			result |= current & 0xF0000000;
 		}
 		if ((opcode & (1 << 16)) && reg.mode != MODE_USER) {
 			result |= operand & 0x000000FF;
 			if constexpr (!targetPSR)
 				bankRegisters((cpuMode)(operand & 0x1F), false);
 		} else {
-			result |= *target & 0x000000FF;
+			result |= current & 0x000000FF;
 		}
 
-#ifdef ARM7TDMI_DISABLE_FIQ
-		result |= 0x00000040;
-#endif
-		*target = result | 0x00000010; // M[4] is always 1
+		if constexpr (!Policy::fiq)
+			result |= 0x00000040;
+		result |= 0x00000010; // M[4] is always 1
+		if constexpr (targetPSR) {
+			*spsr = result;
+		} else {
+			setCPSR(result);
+		}
 		fetchOpcode();
 	}
 
@@ -698,38 +1224,41 @@ public:
 		u32 shiftAmount = (opcode & (0xF << 8)) >> 7;
 		operand = shiftAmount ? ((operand >> shiftAmount) | (operand << (32 - shiftAmount))) : operand;
 
-		u32 *target;
+		u32 *spsr;
+		u32 current;
 		if constexpr (targetPSR) {
-			switch (reg.mode) {
-			case MODE_FIQ: target = &reg.R_fiq[7]; break;
-			case MODE_IRQ: target = &reg.R_irq[7]; break;
-			case MODE_SUPERVISOR: target = &reg.R_svc[7]; break;
-			case MODE_ABORT: target = &reg.R_abt[7]; break;
-			case MODE_UNDEFINED: target = &reg.R_und[7]; break;
-			default: fetchOpcode(); return;
+			spsr = currentSPSR();
+			if (!spsr) {
+				fetchOpcode();
+				return;
 			}
+			current = *spsr;
 		} else {
-			target = &reg.CPSR;
+			current = getCPSR();
 		}
 
 		u32 result = 0;
 		if (opcode & (1 << 19)) {
 			result |= operand & 0xF0000000;
 		} else {
-			result |= *target & 0xF0000000;
+			result |= current & 0xF0000000;
 		}
 		if ((opcode & (1 << 16)) && reg.mode != MODE_USER) {
 			result |= operand & 0x000000FF;
 			if constexpr (!targetPSR)
 				bankRegisters((cpuMode)(operand & 0x1F), false);
 		} else {
-			result |= *target & 0x000000FF;
+			result |= current & 0x000000FF;
 		}
 
-#ifdef ARM7TDMI_DISABLE_FIQ
-		result |= 0x00000040;
-#endif
-		*target = result | 0x00000010; // M[4] is always 1
+		if constexpr (!Policy::fiq)
+			result |= 0x00000040;
+		result |= 0x00000010; // M[4] is always 1
+		if constexpr (targetPSR) {
+			*spsr = result;
+		} else {
+			setCPSR(result);
+		}
 		fetchOpcode();
 	}
 
@@ -769,11 +1298,11 @@ public:
 		u32 result = 0;
 		if constexpr (loadStore) {
 			if constexpr (shBits == 1) { // LDRH
-				result = rotateMisaligned(bus.template read<u16, false>(address, false), address);
+				result = rotateMisaligned(dataRead<u16>(address, false), address);
 			} else if constexpr (shBits == 2) { // LDRSB
-				result = ((i32)((u32)bus.template read<u8, false>(address, false) << 24) >> 24);
+				result = ((i32)((u32)dataRead<u8>(address, false) << 24) >> 24);
 			} else if constexpr (shBits == 3) { // LDRSH
-				result = rotateMisaligned(bus.template read<u16, false>(address, false), address);
+				result = rotateMisaligned(dataRead<u16>(address, false), address);
 
 				if (address & 1) {
 					result = (i32)(result << 24) >> 24;
@@ -783,7 +1312,7 @@ public:
 			}
 		} else {
 			if constexpr (shBits == 1) { // STRH
-				bus.template write<u16>(address, (u16)reg.R[srcDestRegister], false);
+				dataWrite<u16>(address, (u16)reg.R[srcDestRegister], false);
 			}
 
 			nextFetchType = false;
@@ -802,7 +1331,7 @@ public:
 		}
 		if constexpr (loadStore) {
 			reg.R[srcDestRegister] = result;
-			bus.iCycle(1);
+			internalCycles(1);
 
 			if (srcDestRegister == 15) {
 				flushPipeline();
@@ -833,15 +1362,15 @@ public:
 		u32 result = 0;
 		if constexpr (loadStore) { // LDR
 			if constexpr (byteWord) {
-				result = bus.template read<u8, false>(address, false);
+				result = dataRead<u8>(address, false);
 			} else {
-				result = rotateMisaligned(bus.template read<u32, false>(address, false), address);
+				result = rotateMisaligned(dataRead<u32>(address, false), address);
 			}
 		} else { // STR
 			if constexpr (byteWord) {
-				bus.template write<u8>(address, reg.R[srcDestRegister], false);
+				dataWrite<u8>(address, reg.R[srcDestRegister], false);
 			} else {
-				bus.template write<u32>(address, reg.R[srcDestRegister], false);
+				dataWrite<u32>(address, reg.R[srcDestRegister], false);
 			}
 
 			nextFetchType = false;
@@ -860,7 +1389,7 @@ public:
 		}
 		if constexpr (loadStore) {
 			reg.R[srcDestRegister] = result;
-			bus.iCycle(1);
+			internalCycles(1);
 
 			if (srcDestRegister == 15) {
 				flushPipeline();
@@ -910,9 +1439,12 @@ public:
 			if (emptyRegList) { // TODO: find timings for empty list
 				if constexpr (writeBack)
 					reg.R[baseRegister] = writeBackAddress;
-				reg.R[15] = bus.template read<u32, false>(address, false);
+				reg.R[15] = dataRead<u32>(address, false);
 				flushPipeline();
 			} else {
+				u32 values[16];
+				bool block = dataReadBlock(address, values, std::popcount(opcode & 0xFFFF));
+				int blockIndex = 0;
 				for (int i = 0; i < 16; i++) {
 					if (opcode & (1 << i)) {
 						if (firstReadWrite) {
@@ -920,7 +1452,7 @@ public:
 								reg.R[baseRegister] = writeBackAddress;
 						}
 
-						u32 value = bus.template read<u32, false>(address, !firstReadWrite);
+						u32 value = block ? values[blockIndex++] : dataRead<u32>(address, !firstReadWrite);
 						if (useAltRegisterBank && i >= (reg.mode == MODE_FIQ ? 8 : 13) && i != 15) {
 							reg.R_usr[i - 8] = value;
 						} else {
@@ -932,7 +1464,7 @@ public:
 							firstReadWrite = false;
 					}
 				}
-				bus.iCycle(1);
+				internalCycles(1);
 
 				if (opcode & (1 << 15)) { // Treat r15 loads as jumps
 					flushPipeline();
@@ -940,23 +1472,45 @@ public:
 			}
 		} else { // STM
 			if (emptyRegList) {
-				bus.template write<u32>(address, reg.R[15], false);
+				dataWrite<u32>(address, reg.R[15], false);
 				if constexpr (writeBack)
 					reg.R[baseRegister] = writeBackAddress;
 			} else {
-				for (int i = 0; i < 16; i++) {
-					if (opcode & (1 << i)) {
-						if (useAltRegisterBank && i >= (reg.mode == MODE_FIQ ? 8 : 13) && i != 15) {
-							bus.template write<u32>(address, reg.R_usr[i - 8], !firstReadWrite);
-						} else {
-							bus.template write<u32>(address, reg.R[i], !firstReadWrite);
+				u32 values[16];
+				int count = 0;
+				if constexpr (blockTransfers()) {
+					for (int i = 0; i < 16; i++) {
+						if (opcode & (1 << i)) {
+							if (useAltRegisterBank && i >= (reg.mode == MODE_FIQ ? 8 : 13) && i != 15) {
+								values[count] = reg.R_usr[i - 8];
+							} else if (writeBack && (i == baseRegister) && (count != 0)) { // Written back after the first store
+								values[count] = writeBackAddress;
+							} else {
+								values[count] = reg.R[i];
+							}
+							count++;
 						}
-						address += 4;
+					}
+				}
 
-						if (firstReadWrite) {
-							if constexpr (writeBack)
-								reg.R[baseRegister] = writeBackAddress;
-							firstReadWrite = false;
+				if (dataWriteBlock(address, values, count)) {
+					if constexpr (writeBack)
+						reg.R[baseRegister] = writeBackAddress;
+				} else {
+					for (int i = 0; i < 16; i++) {
+						if (opcode & (1 << i)) {
+							if (useAltRegisterBank && i >= (reg.mode == MODE_FIQ ? 8 : 13) && i != 15) {
+								dataWrite<u32>(address, reg.R_usr[i - 8], !firstReadWrite);
+							} else {
+								dataWrite<u32>(address, reg.R[i], !firstReadWrite);
+							}
+							address += 4;
+
+							if (firstReadWrite) {
+								if constexpr (writeBack)
+									reg.R[baseRegister] = writeBackAddress;
+								firstReadWrite = false;
+							}
 						}
 					}
 				}
@@ -978,6 +1532,9 @@ public:
 			reg.R[14] = reg.R[15] - 8;
 		reg.R[15] = address;
 		flushPipeline();
+
+		if constexpr (!link)
+			checkIdleLoop(address, ((i32)((opcode & 0x00FFFFFF) << 8)) >> 6);
 	}
 
 	// This is just barely stubbed to pass a test
@@ -1009,25 +1566,28 @@ public:
 	/* THUMB Instructions */
 	template <int op, int shiftAmount> void thumbMoveShiftedReg(u16 opcode)  {
 		u32 shiftOperand = reg.R[(opcode >> 3) & 7];
+		bool carry = false;
 
 		switch (op) {
 		case 0: // LSL
 			if (shiftAmount != 0) {
 				if (shiftAmount > 31) {
-					reg.flagC = (shiftAmount == 32) ? (shiftOperand & 1) : 0;
+					carry = (shiftAmount == 32) ? (shiftOperand & 1) : 0;
 					shiftOperand = 0;
 					break;
 				}
-				reg.flagC = (bool)(shiftOperand & (1 << (31 - (shiftAmount - 1))));
+				carry = (bool)(shiftOperand & (1 << (31 - (shiftAmount - 1))));
 				shiftOperand <<= shiftAmount;
+			} else {
+				carry = reg.flagC;
 			}
 			break;
 		case 1: // LSR
 			if (shiftAmount == 0) {
-				reg.flagC = shiftOperand >> 31;
+				carry = shiftOperand >> 31;
 				shiftOperand = 0;
 			} else {
-				reg.flagC = (shiftOperand >> (shiftAmount - 1)) & 1;
+				carry = (shiftOperand >> (shiftAmount - 1)) & 1;
 				shiftOperand = shiftOperand >> shiftAmount;
 			}
 			break;
@@ -1035,20 +1595,19 @@ public:
 			if (shiftAmount == 0) {
 				if (shiftOperand & (1 << 31)) {
 					shiftOperand = 0xFFFFFFFF;
-					reg.flagC = true;
+					carry = true;
 				} else {
 					shiftOperand = 0;
-					reg.flagC = false;
+					carry = false;
 				}
 			} else {
-				reg.flagC = (shiftOperand >> (shiftAmount - 1)) & 1;
+				carry = (shiftOperand >> (shiftAmount - 1)) & 1;
 				shiftOperand = ((i32)shiftOperand) >> shiftAmount;
 			}
 			break;
 		}
 
-		reg.flagN = shiftOperand >> 31;
-		reg.flagZ = shiftOperand == 0;
+		setFlagsLogical(shiftOperand, carry);
 		reg.R[opcode & 7] = shiftOperand;
 		fetchOpcode();
 	}
@@ -1059,17 +1618,11 @@ public:
 
 		u32 result;
 		if (op) { // SUB
-			reg.flagC = operand1 >= operand2;
 			result = operand1 - operand2;
-			reg.flagV = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
-			reg.flagN = result >> 31;
-			reg.flagZ = result == 0;
+			setFlagsSub(operand1, operand2, result);
 		} else { // ADD
-			reg.flagC = ((u64)operand1 + (u64)operand2) >> 32;
 			result = operand1 + operand2;
-			reg.flagV = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
-			reg.flagN = result >> 31;
-			reg.flagZ = result == 0;
+			setFlagsAdd(operand1, operand2, result);
 		}
 
 		reg.R[opcode & 7] = result;
@@ -1084,26 +1637,19 @@ public:
 		switch (op) {
 		case 0: // MOV
 			result = operand2;
+			setFlagsNZ(result);
 			break;
 		case 1: // CMP
-			reg.flagC = operand1 >= operand2;
+		case 3: // SUB
 			result = operand1 - operand2;
-			reg.flagV = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
+			setFlagsSub(operand1, operand2, result);
 			break;
 		case 2: // ADD
-			reg.flagC = ((u64)operand1 + (u64)operand2) >> 32;
 			result = operand1 + operand2;
-			reg.flagV = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
-			break;
-		case 3: // SUB
-			reg.flagC = operand1 >= operand2;
-			result = operand1 - operand2;
-			reg.flagV = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
+			setFlagsAdd(operand1, operand2, result);
 			break;
 		}
 
-		reg.flagN = result >> 31;
-		reg.flagZ = result == 0;
 		if constexpr (op != 1)
 			reg.R[destinationReg] = result;
 		fetchOpcode();
@@ -1118,6 +1664,7 @@ public:
 		constexpr bool endWithIdle = ((op == 0x2) || (op == 0x3) || (op == 0x4) || (op == 0x7) || (op == 0xD));
 
 		u32 result;
+		bool carry = false;
 		switch (op) {
 		case 0x0: // AND
 			result = operand1 & operand2;
@@ -1128,12 +1675,13 @@ public:
 		case 0x2: // LSL
 			if (operand2 == 0) {
 				result = operand1;
+				carry = reg.flagC;
 			} else {
 				if (operand2 > 31) {
-					reg.flagC = (operand2 == 32) ? (operand1 & 1) : 0;
+					carry = (operand2 == 32) ? (operand1 & 1) : 0;
 					result = 0;
 				} else {
-					reg.flagC = (operand1 & (1 << (31 - (operand2 - 1)))) > 0;
+					carry = (operand1 & (1 << (31 - (operand2 - 1)))) > 0;
 					result = operand1 << operand2;
 				}
 			}
@@ -1142,14 +1690,15 @@ public:
 		case 0x3: // LSR
 			if (operand2 == 0) {
 				result = operand1;
+				carry = reg.flagC;
 			} else if (operand2 == 32) {
 				result = 0;
-				reg.flagC = operand1 >> 31;
+				carry = operand1 >> 31;
 			} else if (operand2 > 32) {
 				result = 0;
-				reg.flagC = false;
+				carry = false;
 			} else {
-				reg.flagC = (operand1 >> (operand2 - 1)) & 1;
+				carry = (operand1 >> (operand2 - 1)) & 1;
 				result = operand1 >> operand2;
 			}
 			fetchOpcode();
@@ -1157,40 +1706,42 @@ public:
 		case 0x4: // ASR
 			if (operand2 == 0) {
 				result = operand1;
+				carry = reg.flagC;
 			} else if (operand2 > 31) {
 				if (operand1 & (1 << 31)) {
 					result = 0xFFFFFFFF;
-					reg.flagC = true;
+					carry = true;
 				} else {
 					result = 0;
-					reg.flagC = false;
+					carry = false;
 				}
 			} else {
-				reg.flagC = (operand1 >> (operand2 - 1)) & 1;
+				carry = (operand1 >> (operand2 - 1)) & 1;
 				result = ((i32)operand1) >> operand2;
 			}
 			fetchOpcode();
 			break;
 		case 0x5: // ADC
-			result = operand1 + operand2 + reg.flagC;
-			reg.flagC = ((u64)operand1 + (u64)operand2 + reg.flagC) >> 32;
-			reg.flagV = (~(operand1 ^ operand2) & ((operand1 ^ result))) >> 31;
+			carry = reg.flagC;
+			result = operand1 + operand2 + carry;
+			setFlags(result, ((u64)operand1 + (u64)operand2 + carry) >> 32, (~(operand1 ^ operand2) & ((operand1 ^ result))) >> 31);
 			break;
 		case 0x6: // SBC
-			result = (u64)operand1 - ((u64)operand2 + !reg.flagC);
-			reg.flagC = (u64)operand1 >= ((u64)operand2 + !reg.flagC);
-			reg.flagV = ((operand1 ^ operand2) & (operand1 ^ result)) >> 31;
+			carry = reg.flagC;
+			result = (u64)operand1 - ((u64)operand2 + !carry);
+			setFlags(result, (u64)operand1 >= ((u64)operand2 + !carry), ((operand1 ^ operand2) & (operand1 ^ result)) >> 31);
 			break;
 		case 0x7: // ROR
 			if (operand2 == 0) {
 				result = operand1;
+				carry = reg.flagC;
 			} else {
 				operand2 &= 31;
 				if (operand2 == 0) {
-					reg.flagC = operand1 >> 31;
+					carry = operand1 >> 31;
 					result = operand1;
 				} else {
-					reg.flagC = (bool)(operand1 & (1 << (operand2 - 1)));
+					carry = (bool)(operand1 & (1 << (operand2 - 1)));
 					result = (operand1 >> operand2) | (operand1 << (32 - operand2));
 				}
 			}
@@ -1200,26 +1751,23 @@ public:
 			result = operand1 & operand2;
 			break;
 		case 0x9: // NEG
-			reg.flagC = 0 >= operand2;
 			result = 0 - operand2;
-			reg.flagV = (operand2 & result & 0x80000000) > 0;
+			setFlagsSub(0, operand2, result);
 			break;
 		case 0xA: // CMP
-			reg.flagC = operand1 >= operand2;
 			result = operand1 - operand2;
-			reg.flagV = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
+			setFlagsSub(operand1, operand2, result);
 			break;
 		case 0xB: // CMN
-			reg.flagC = ((u64)operand1 + (u64)operand2) >> 32;
 			result = operand1 + operand2;
-			reg.flagV = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
+			setFlagsAdd(operand1, operand2, result);
 			break;
 		case 0xC: // ORR
 			result = operand1 | operand2;
 			break;
 		case 0xD: // MUL
 			fetchOpcode();
-			bus.iCycle((31 - std::max(std::countl_zero(operand1), std::countl_one(operand1))) / 8);
+			internalCycles((31 - std::max(std::countl_zero(operand1), std::countl_one(operand1))) / 8);
 
 			result = operand1 * operand2;
 			break;
@@ -1232,13 +1780,16 @@ public:
 		}
 
 		// Compute common flags
-		reg.flagN = result >> 31;
-		reg.flagZ = result == 0;
+		if constexpr ((op == 0x2) || (op == 0x3) || (op == 0x4) || (op == 0x7)) { // Shifts
+			setFlagsLogical(result, carry);
+		} else if constexpr ((op == 0x0) || (op == 0x1) || (op == 0x8) || (op >= 0xC)) { // Logical operations and MUL
+			setFlagsNZ(result);
+		}
 
 		if constexpr (writeResult)
 			reg.R[destinationReg] = result;
 		if constexpr (endWithIdle) {
-			bus.iCycle(1);
+			internalCycles(1);
 		} else {
 			fetchOpcode();
 		}
@@ -1254,11 +1805,8 @@ public:
 			result = reg.R[operand1] + reg.R[operand2];
 			break;
 		case 1: // CMP
-			reg.flagC = reg.R[operand1] >= reg.R[operand2];
 			result = reg.R[operand1] - reg.R[operand2];
-			reg.flagV = ((reg.R[operand1] ^ reg.R[operand2]) & ((reg.R[operand1] ^ result)) & 0x80000000) > 0;
-			reg.flagN = result >> 31;
-			reg.flagZ = result == 0;
+			setFlagsSub(reg.R[operand1], reg.R[operand2], result);
 			break;
 		case 2: // MOV
 			result = reg.R[operand2];
@@ -1286,8 +1834,8 @@ public:
 		u32 address = (reg.R[15] + ((opcode & 0xFF) << 2)) & ~3;
 		fetchOpcode();
 
-		reg.R[destinationReg] = rotateMisaligned(bus.template read<u32, false>(address, false), address);
-		bus.iCycle(1);
+		reg.R[destinationReg] = rotateMisaligned(dataRead<u32>(address, false), address);
+		internalCycles(1);
 	}
 
 	template <bool loadStore, bool byteWord, int offsetReg> void thumbLoadStoreRegOffset(u16 opcode) {
@@ -1297,17 +1845,17 @@ public:
 
 		if constexpr (loadStore) {
 			if constexpr (byteWord) { // LDRB
-				reg.R[srcDestRegister] = bus.template read<u8, false>(address, false);
+				reg.R[srcDestRegister] = dataRead<u8>(address, false);
 			} else { // LDR
-				reg.R[srcDestRegister] = rotateMisaligned(bus.template read<u32, false>(address, false), address);
+				reg.R[srcDestRegister] = rotateMisaligned(dataRead<u32>(address, false), address);
 			}
 
-			bus.iCycle(1);
+			internalCycles(1);
 		} else {
 			if constexpr (byteWord) { // STRB
-				bus.template write<u8>(address, (u8)reg.R[srcDestRegister], false);
+				dataWrite<u8>(address, (u8)reg.R[srcDestRegister], false);
 			} else { // STR
-				bus.template write<u32>(address, reg.R[srcDestRegister], false);
+				dataWrite<u32>(address, reg.R[srcDestRegister], false);
 			}
 
 			nextFetchType = false;
@@ -1322,18 +1870,18 @@ public:
 		u32 result = 0;
 		switch (hsBits) {
 		case 0: // STRH
-			bus.template write<u16>(address, (u16)reg.R[srcDestRegister], false);
+			dataWrite<u16>(address, (u16)reg.R[srcDestRegister], false);
 			nextFetchType = false;
 			break;
 		case 1: // LDSB
-			result = bus.template read<u8, false>(address, false);
+			result = dataRead<u8>(address, false);
 			result = (i32)(result << 24) >> 24;
 			break;
 		case 2: // LDRH
-			result = rotateMisaligned(bus.template read<u16, false>(address, false), address);
+			result = rotateMisaligned(dataRead<u16>(address, false), address);
 			break;
 		case 3: // LDSH
-			result = rotateMisaligned(bus.template read<u16, false>(address, false), address);
+			result = rotateMisaligned(dataRead<u16>(address, false), address);
 
 			if (address & 1) {
 				result = (i32)(result << 24) >> 24;
@@ -1345,7 +1893,7 @@ public:
 
 		if constexpr (hsBits != 0) {
 			reg.R[srcDestRegister] = result;
-			bus.iCycle(1);
+			internalCycles(1);
 		}
 	}
 
@@ -1356,16 +1904,16 @@ public:
 
 		if constexpr (loadStore) {
 			if constexpr (byteWord) { // LDRB
-				reg.R[srcDestRegister] = bus.template read<u8, false>(address, false);
+				reg.R[srcDestRegister] = dataRead<u8>(address, false);
 			} else { // LDR
-				reg.R[srcDestRegister] = rotateMisaligned(bus.template read<u32, false>(address, false), address);
+				reg.R[srcDestRegister] = rotateMisaligned(dataRead<u32>(address, false), address);
 			}
-			bus.iCycle(1);
+			internalCycles(1);
 		} else {
 			if constexpr (byteWord) { // STRB
-				bus.template write<u8>(address, (u8)reg.R[srcDestRegister], false);
+				dataWrite<u8>(address, (u8)reg.R[srcDestRegister], false);
 			} else { // STR
-				bus.template write<u32>(address, reg.R[srcDestRegister], false);
+				dataWrite<u32>(address, reg.R[srcDestRegister], false);
 			}
 
 			nextFetchType = false;
@@ -1378,11 +1926,11 @@ public:
 		fetchOpcode();
 
 		if constexpr (loadStore) { // LDRH
-			reg.R[srcDestRegister] = rotateMisaligned(bus.template read<u16, false>(address, false), address);
+			reg.R[srcDestRegister] = rotateMisaligned(dataRead<u16>(address, false), address);
 
-			bus.iCycle(1);
+			internalCycles(1);
 		} else { // STRH
-			bus.template write<u16>(address, (u16)reg.R[srcDestRegister], false);
+			dataWrite<u16>(address, (u16)reg.R[srcDestRegister], false);
 
 			nextFetchType = false;
 		}
@@ -1393,11 +1941,11 @@ public:
 		fetchOpcode();
 
 		if constexpr (loadStore) {
-			reg.R[destinationReg] = bus.template read<u32, false>(address, false);
+			reg.R[destinationReg] = dataRead<u32>(address, false);
 
-			bus.iCycle(1);
+			internalCycles(1);
 		} else {
-			bus.template write<u32>(address, reg.R[destinationReg], false);
+			dataWrite<u32>(address, reg.R[destinationReg], false);
 
 			nextFetchType = false;
 		}
@@ -1436,22 +1984,36 @@ public:
 			fetchOpcode(); // Writeback really should be inside the main loop but this works
 
 			if (emptyRegList) {
-				reg.R[15] = bus.template read<u32, false>(address, false);
+				reg.R[15] = dataRead<u32>(address, false);
 				flushPipeline();
 			} else {
-				for (int i = 0; i < 8; i++) {
-					if (opcode & (1 << i)) {
-						reg.R[i] = bus.template read<u32, false>(address, !firstReadWrite);
-						address += 4;
+				u32 values[9];
+				if (dataReadBlock(address, values, std::popcount((u32)opcode & 0xFF) + pcLr)) {
+					int blockIndex = 0;
+					for (int i = 0; i < 8; i++) {
+						if (opcode & (1 << i))
+							reg.R[i] = values[blockIndex++];
+					}
+					internalCycles(1);
+					if constexpr (pcLr) {
+						reg.R[15] = values[blockIndex];
+						flushPipeline();
+					}
+				} else {
+					for (int i = 0; i < 8; i++) {
+						if (opcode & (1 << i)) {
+							reg.R[i] = dataRead<u32>(address, !firstReadWrite);
+							address += 4;
 
-						if (firstReadWrite)
-							firstReadWrite = false;
+							if (firstReadWrite)
+								firstReadWrite = false;
+						}
+					}
+					internalCycles(1);
+					if constexpr (pcLr) {
+						reg.R[15] = dataRead<u32>(address, true);
+						flushPipeline();
 					}
-				}
-				bus.iCycle(1);
-				if constexpr (pcLr) {
-					reg.R[15] = bus.template read<u32, false>(address, true);
-					flushPipeline();
 				}
 			}
 		} else { // PUSH/STMDB!
@@ -1462,16 +2024,29 @@ public:
 			fetchOpcode();
 
 			if (emptyRegList) {
-				bus.template write<u32>(address, reg.R[15] + 2, false);
+				dataWrite<u32>(address, reg.R[15] + 2, false);
 			} else {
-				for (int i = 0; i < 8; i++) {
-					if (opcode & (1 << i)) {
-						bus.template write<u32>(address, reg.R[i], !firstReadWrite);
-						address += 4;
+				u32 values[9];
+				int count = 0;
+				if constexpr (blockTransfers()) {
+					for (int i = 0; i < 8; i++) {
+						if (opcode & (1 << i))
+							values[count++] = reg.R[i];
 					}
+					if constexpr (pcLr)
+						values[count++] = reg.R[14];
+				}
+
+				if (!dataWriteBlock(address, values, count)) {
+					for (int i = 0; i < 8; i++) {
+						if (opcode & (1 << i)) {
+							dataWrite<u32>(address, reg.R[i], !firstReadWrite);
+							address += 4;
+						}
+					}
+					if constexpr (pcLr)
+						dataWrite<u32>(address, reg.R[14], true);
 				}
-				if constexpr (pcLr)
-					bus.template write<u32>(address, reg.R[14], true);
 			}
 			nextFetchType = false;
 		}
@@ -1491,36 +2066,54 @@ public:
 		if constexpr (loadStore) { // LDMIA!
 			if (emptyRegList) {
 				reg.R[baseReg] = writeBackAddress;
-				reg.R[15] = bus.template read<u32, false>(address, true);
+				reg.R[15] = dataRead<u32>(address, true);
 				flushPipeline();
 			} else {
+				u32 values[8];
+				bool block = dataReadBlock(address, values, std::popcount((u32)opcode & 0xFF));
+				int blockIndex = 0;
 				for (int i = 0; i < 8; i++) {
 					if (opcode & (1 << i)) {
 						if (firstReadWrite)
 							reg.R[baseReg] = writeBackAddress;
 
-						reg.R[i] = bus.template read<u32, false>(address, !firstReadWrite);
+						reg.R[i] = block ? values[blockIndex++] : dataRead<u32>(address, !firstReadWrite);
 						address += 4;
 
 						if (firstReadWrite)
 							firstReadWrite = false;
 					}
 				}
-				bus.iCycle(1);
+				internalCycles(1);
 			}
 		} else { // STMIA!
 			if (emptyRegList) {
-				bus.template write<u32>(address, reg.R[15], false);
+				dataWrite<u32>(address, reg.R[15], false);
 				reg.R[baseReg] = writeBackAddress;
 			} else {
-				for (int i = 0; i < 8; i++) {
-					if (opcode & (1 << i)) {
-						bus.template write<u32>(address, reg.R[i], !firstReadWrite);
-						address += 4;
+				u32 values[8];
+				int count = 0;
+				if constexpr (blockTransfers()) {
+					for (int i = 0; i < 8; i++) {
+						if (opcode & (1 << i)) {
+							values[count] = ((i == baseReg) && (count != 0)) ? writeBackAddress : reg.R[i]; // Written back after the first store
+							count++;
+						}
+					}
+				}
 
-						if (firstReadWrite) {
-							reg.R[baseReg] = writeBackAddress;
-							firstReadWrite = false;
+				if (dataWriteBlock(address, values, count)) {
+					reg.R[baseReg] = writeBackAddress;
+				} else {
+					for (int i = 0; i < 8; i++) {
+						if (opcode & (1 << i)) {
+							dataWrite<u32>(address, reg.R[i], !firstReadWrite);
+							address += 4;
+
+							if (firstReadWrite) {
+								reg.R[baseReg] = writeBackAddress;
+								firstReadWrite = false;
+							}
 						}
 					}
 				}
@@ -1536,6 +2129,7 @@ public:
 		if (checkCondition(condition)) {
 			reg.R[15] = newAddress;
 			flushPipeline();
+			checkIdleLoop(newAddress, (i16)(opcode << 8) >> 7);
 		}
 	}
 
@@ -1563,6 +2157,7 @@ public:
 
 		reg.R[15] = newAddress;
 		flushPipeline();
+		checkIdleLoop(newAddress, (i16)(opcode << 5) >> 4);
 	}
 
 	template <bool lowHigh> void thumbLongBranchLink(u16 opcode) {
@@ -1663,54 +2258,54 @@ public:
 	static const u16 thumbLongBranchLinkMask = 0b1111'0000'00;
 	static const u16 thumbLongBranchLinkBits = 0b1111'0000'00;
 
-	using lutEntry = void (ARM7TDMI<T>::*)(u32);
-	using thumbLutEntry = void (ARM7TDMI<T>::*)(u16);
+	using lutEntry = void (ARM7TDMI<T, Policy>::*)(u32);
+	using thumbLutEntry = void (ARM7TDMI<T, Policy>::*)(u16);
 
 	template <std::size_t lutFillIndex>
 	constexpr static lutEntry decode() {
 		if constexpr ((lutFillIndex & armUndefined1Mask) == armUndefined1Bits) {
-			return &ARM7TDMI<T>::undefined;
+			return &ARM7TDMI<T, Policy>::undefined;
 		} else if constexpr ((lutFillIndex & armUndefined2Mask) == armUndefined2Bits) {
-			return &ARM7TDMI<T>::undefined;
+			return &ARM7TDMI<T, Policy>::undefined;
 		} else if constexpr ((lutFillIndex & armUndefined3Mask) == armUndefined3Bits) {
-			return &ARM7TDMI<T>::undefined;
+			return &ARM7TDMI<T, Policy>::undefined;
 		} else if constexpr ((lutFillIndex & armUndefined4Mask) == armUndefined4Bits) {
-			return &ARM7TDMI<T>::undefined;
+			return &ARM7TDMI<T, Policy>::undefined;
 		} else if constexpr ((lutFillIndex & armMultiplyMask) == armMultiplyBits) {
-			return &ARM7TDMI<T>::multiply<(bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>;
+			return &ARM7TDMI<T, Policy>::multiply<(bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>;
 		} else if constexpr ((lutFillIndex & armMultiplyLongMask) == armMultiplyLongBits) {
-			return &ARM7TDMI<T>::multiplyLong<(bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>;
+			return &ARM7TDMI<T, Policy>::multiplyLong<(bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>;
 		} else if constexpr ((lutFillIndex & armPsrLoadMask) == armPsrLoadBits) {
-			return &ARM7TDMI<T>::psrLoad<(bool)(lutFillIndex & 0b0000'0100'0000)>;
+			return &ARM7TDMI<T, Policy>::psrLoad<(bool)(lutFillIndex & 0b0000'0100'0000)>;
 		} else if constexpr ((lutFillIndex & armPsrStoreRegMask) == armPsrStoreRegBits) {
-			return &ARM7TDMI<T>::psrStoreReg<(bool)(lutFillIndex & 0b0000'0100'0000)>;
+			return &ARM7TDMI<T, Policy>::psrStoreReg<(bool)(lutFillIndex & 0b0000'0100'0000)>;
 		} else if constexpr ((lutFillIndex & armPsrStoreImmediateMask) == armPsrStoreImmediateBits) {
-			return &ARM7TDMI<T>::psrStoreImmediate<(bool)(lutFillIndex & 0b0000'0100'0000)>;
+			return &ARM7TDMI<T, Policy>::psrStoreImmediate<(bool)(lutFillIndex & 0b0000'0100'0000)>;
 		} else if constexpr ((lutFillIndex & armSingleDataSwapMask) == armSingleDataSwapBits) {
-			return &ARM7TDMI<T>::singleDataSwap<(bool)(lutFillIndex & 0b0000'0100'0000)>;
+			return &ARM7TDMI<T, Policy>::singleDataSwap<(bool)(lutFillIndex & 0b0000'0100'0000)>;
 		} else if constexpr ((lutFillIndex & armBranchExchangeMask) == armBranchExchangeBits) {
-			return &ARM7TDMI<T>::branchExchange;
+			return &ARM7TDMI<T, Policy>::branchExchange;
 		} else if constexpr ((lutFillIndex & armHalfwordDataTransferMask) == armHalfwordDataTransferBits) {
-			return &ARM7TDMI<T>::halfwordDataTransfer<(bool)(lutFillIndex & 0b0001'0000'0000), (bool)(lutFillIndex & 0b0000'1000'0000), (bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000), ((lutFillIndex & 0b0000'0000'0110) >> 1)>;
+			return &ARM7TDMI<T, Policy>::halfwordDataTransfer<(bool)(lutFillIndex & 0b0001'0000'0000), (bool)(lutFillIndex & 0b0000'1000'0000), (bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000), ((lutFillIndex & 0b0000'0000'0110) >> 1)>;
 		} else if constexpr ((lutFillIndex & armDataProcessingMask) == armDataProcessingBits) {
-			return &ARM7TDMI<T>::dataProcessing<(bool)(lutFillIndex & 0b0010'0000'0000), ((lutFillIndex & 0b0001'1110'0000) >> 5), (bool)(lutFillIndex & 0b0000'0001'0000)>;
+			return &ARM7TDMI<T, Policy>::dataProcessing<(bool)(lutFillIndex & 0b0010'0000'0000), ((lutFillIndex & 0b0001'1110'0000) >> 5), (bool)(lutFillIndex & 0b0000'0001'0000)>;
 		} else if constexpr ((lutFillIndex & armSingleDataTransferMask) == armSingleDataTransferBits) {
-			return &ARM7TDMI<T>::singleDataTransfer<(bool)(lutFillIndex & 0b0010'0000'0000), (bool)(lutFillIndex & 0b0001'0000'0000), (bool)(lutFillIndex & 0b0000'1000'0000), (bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>;
+			return &ARM7TDMI<T, Policy>::singleDataTransfer<(bool)(lutFillIndex & 0b0010'0000'0000), (bool)(lutFillIndex & 0b0001'0000'0000), (bool)(lutFillIndex & 0b0000'1000'0000), (bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>;
 		} else if constexpr ((lutFillIndex & armBlockDataTransferMask) == armBlockDataTransferBits) {
-			return &ARM7TDMI<T>::blockDataTransfer<(bool)(lutFillIndex & 0b0001'0000'0000), (bool)(lutFillIndex & 0b0000'1000'0000), (bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>;
+			return &ARM7TDMI<T, Policy>::blockDataTransfer<(bool)(lutFillIndex & 0b0001'0000'0000), (bool)(lutFillIndex & 0b0000'1000'0000), (bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>;
 		} else if constexpr ((lutFillIndex & armBranchMask) == armBranchBits) {
-			return &ARM7TDMI<T>::branch<(bool)(lutFillIndex & 0b0001'0000'0000)>;
+			return &ARM7TDMI<T, Policy>::branch<(bool)(lutFillIndex & 0b0001'0000'0000)>;
 		} else if constexpr ((lutFillIndex & armCoprocessorDataTransferMask) == armCoprocessorDataTransferBits) {
-			return &ARM7TDMI<T>::undefined;
+			return &ARM7TDMI<T, Policy>::undefined;
 		} else if constexpr ((lutFillIndex & armCoprocessorDataOperationMask) == armCoprocessorDataOperationBits) {
-			return &ARM7TDMI<T>::undefined;
+			return &ARM7TDMI<T, Policy>::undefined;
 		} else if constexpr ((lutFillIndex & armCoprocessorRegisterTransferMask) == armCoprocessorRegisterTransferBits) {
-			return &ARM7TDMI<T>::armCoprocessorRegisterTransfer<(bool)(lutFillIndex & 0b0000'0001'0000)>;
+			return &ARM7TDMI<T, Policy>::armCoprocessorRegisterTransfer<(bool)(lutFillIndex & 0b0000'0001'0000)>;
 		} else if constexpr ((lutFillIndex & armSoftwareInterruptMask) == armSoftwareInterruptBits) {
-			return &ARM7TDMI<T>::softwareInterrupt;
+			return &ARM7TDMI<T, Policy>::softwareInterrupt;
 		}
 
-		return &ARM7TDMI<T>::unknownOpcodeArm;
+		return &ARM7TDMI<T, Policy>::unknownOpcodeArm;
 	}
 	template <std::size_t... lutFillIndex>
 	constexpr static std::array<lutEntry, 4096> generateTable(std::index_sequence<lutFillIndex...>) {
@@ -1723,50 +2318,50 @@ public:
 	template <std::size_t lutFillIndex>
 	constexpr static thumbLutEntry decodeThumb() {
 		if constexpr ((lutFillIndex & thumbAddSubtractMask) == thumbAddSubtractBits) {
-			return &ARM7TDMI<T>::thumbAddSubtract<(bool)(lutFillIndex & 0b0000'0100'00), (bool)(lutFillIndex & 0b0000'0010'00), (lutFillIndex & 0b0000'0001'11)>;
+			return &ARM7TDMI<T, Policy>::thumbAddSubtract<(bool)(lutFillIndex & 0b0000'0100'00), (bool)(lutFillIndex & 0b0000'0010'00), (lutFillIndex & 0b0000'0001'11)>;
 		} else if constexpr ((lutFillIndex & thumbMoveShiftedRegMask) == thumbMoveShiftedRegBits) {
-			return &ARM7TDMI<T>::thumbMoveShiftedReg<((lutFillIndex & 0b0001'1000'00) >> 5), (lutFillIndex & 0b0000'0111'11)>;
+			return &ARM7TDMI<T, Policy>::thumbMoveShiftedReg<((lutFillIndex & 0b0001'1000'00) >> 5), (lutFillIndex & 0b0000'0111'11)>;
 		} else if constexpr ((lutFillIndex & thumbAluImmediateMask) == thumbAluImmediateBits) {
-			return &ARM7TDMI<T>::thumbAluImmediate<((lutFillIndex & 0b0001'1000'00) >> 5), ((lutFillIndex & 0b0000'0111'00) >> 2)>;
+			return &ARM7TDMI<T, Policy>::thumbAluImmediate<((lutFillIndex & 0b0001'1000'00) >> 5), ((lutFillIndex & 0b0000'0111'00) >> 2)>;
 		} else if constexpr ((lutFillIndex & thumbAluRegMask) == thumbAluRegBits) {
-			return &ARM7TDMI<T>::thumbAluReg<(lutFillIndex & 0b0000'0011'11)>;
+			return &ARM7TDMI<T, Policy>::thumbAluReg<(lutFillIndex & 0b0000'0011'11)>;
 		} else if constexpr ((lutFillIndex & thumbHighRegOperationMask) == thumbHighRegOperationBits) {
-			return &ARM7TDMI<T>::thumbHighRegOperation<((lutFillIndex & 0b0000'0011'00) >> 2), (bool)(lutFillIndex & 0b0000'0000'10), (bool)(lutFillIndex & 0b0000'0000'01)>;
+			return &ARM7TDMI<T, Policy>::thumbHighRegOperation<((lutFillIndex & 0b0000'0011'00) >> 2), (bool)(lutFillIndex & 0b0000'0000'10), (bool)(lutFillIndex & 0b0000'0000'01)>;
 		} else if constexpr ((lutFillIndex & thumbPcRelativeLoadMask) == thumbPcRelativeLoadBits) {
-			return &ARM7TDMI<T>::thumbPcRelativeLoad<((lutFillIndex & 0b0000'0111'00) >> 2)>;
+			return &ARM7TDMI<T, Policy>::thumbPcRelativeLoad<((lutFillIndex & 0b0000'0111'00) >> 2)>;
 		} else if constexpr ((lutFillIndex & thumbLoadStoreRegOffsetMask) == thumbLoadStoreRegOffsetBits) {
-			return &ARM7TDMI<T>::thumbLoadStoreRegOffset<(bool)(lutFillIndex & 0b0000'1000'00), (bool)(lutFillIndex & 0b0000'0100'00), (lutFillIndex & 0b0000'0001'11)>;
+			return &ARM7TDMI<T, Policy>::thumbLoadStoreRegOffset<(bool)(lutFillIndex & 0b0000'1000'00), (bool)(lutFillIndex & 0b0000'0100'00), (lutFillIndex & 0b0000'0001'11)>;
 		} else if constexpr ((lutFillIndex & thumbLoadStoreSextMask) == thumbLoadStoreSextBits) {
-			return &ARM7TDMI<T>::thumbLoadStoreSext<((lutFillIndex & 0b0000'1100'00) >> 4), (lutFillIndex & 0b0000'0001'11)>;
+			return &ARM7TDMI<T, Policy>::thumbLoadStoreSext<((lutFillIndex & 0b0000'1100'00) >> 4), (lutFillIndex & 0b0000'0001'11)>;
 		} else if constexpr ((lutFillIndex & thumbLoadStoreImmediateOffsetMask) == thumbLoadStoreImmediateOffsetBits) {
-			return &ARM7TDMI<T>::thumbLoadStoreImmediateOffset<(bool)(lutFillIndex & 0b0001'0000'00), (bool)(lutFillIndex & 0b0000'1000'00), (lutFillIndex & 0b0000'0111'11)>;
+			return &ARM7TDMI<T, Policy>::thumbLoadStoreImmediateOffset<(bool)(lutFillIndex & 0b0001'0000'00), (bool)(lutFillIndex & 0b0000'1000'00), (lutFillIndex & 0b0000'0111'11)>;
 		} else if constexpr ((lutFillIndex & thumbLoadStoreHalfwordMask) == thumbLoadStoreHalfwordBits) {
-			return &ARM7TDMI<T>::thumbLoadStoreHalfword<(bool)(lutFillIndex & 0b0000'1000'00), (lutFillIndex & 0b0000'0111'11)>;
+			return &ARM7TDMI<T, Policy>::thumbLoadStoreHalfword<(bool)(lutFillIndex & 0b0000'1000'00), (lutFillIndex & 0b0000'0111'11)>;
 		} else if constexpr ((lutFillIndex & thumbSpRelativeLoadStoreMask) == thumbSpRelativeLoadStoreBits) {
-			return &ARM7TDMI<T>::thumbSpRelativeLoadStore<(bool)(lutFillIndex & 0b0000'1000'00), ((lutFillIndex & 0b0000'0111'00) >> 2)>;
+			return &ARM7TDMI<T, Policy>::thumbSpRelativeLoadStore<(bool)(lutFillIndex & 0b0000'1000'00), ((lutFillIndex & 0b0000'0111'00) >> 2)>;
 		} else if constexpr ((lutFillIndex & thumbLoadAddressMask) == thumbLoadAddressBits) {
-			return &ARM7TDMI<T>::thumbLoadAddress<(bool)(lutFillIndex & 0b0000'1000'00), ((lutFillIndex & 0b0000'0111'00) >> 2)>;
+			return &ARM7TDMI<T, Policy>::thumbLoadAddress<(bool)(lutFillIndex & 0b0000'1000'00), ((lutFillIndex & 0b0000'0111'00) >> 2)>;
 		} else if constexpr ((lutFillIndex & thumbSpAddOffsetMask) == thumbSpAddOffsetBits) {
-			return &ARM7TDMI<T>::thumbSpAddOffset<(bool)(lutFillIndex & 0b0000'0000'10)>;
+			return &ARM7TDMI<T, Policy>::thumbSpAddOffset<(bool)(lutFillIndex & 0b0000'0000'10)>;
 		} else if constexpr ((lutFillIndex & thumbPushPopRegistersMask) == thumbPushPopRegistersBits) {
-			return &ARM7TDMI<T>::thumbPushPopRegisters<(bool)(lutFillIndex & 0b0000'1000'00), (bool)(lutFillIndex & 0b0000'0001'00)>;
+			return &ARM7TDMI<T, Policy>::thumbPushPopRegisters<(bool)(lutFillIndex & 0b0000'1000'00), (bool)(lutFillIndex & 0b0000'0001'00)>;
 		} else if constexpr ((lutFillIndex & thumbMultipleLoadStoreMask) == thumbMultipleLoadStoreBits) {
-			return &ARM7TDMI<T>::thumbMultipleLoadStore<(bool)(lutFillIndex & 0b0000'1000'00), ((lutFillIndex & 0b0000'0111'00) >> 2)>;
+			return &ARM7TDMI<T, Policy>::thumbMultipleLoadStore<(bool)(lutFillIndex & 0b0000'1000'00), ((lutFillIndex & 0b0000'0111'00) >> 2)>;
 		} else if constexpr ((lutFillIndex & thumbUndefined1Mask) == thumbUndefined1Bits) {
-			return &ARM7TDMI<T>::thumbUndefined;
+			return &ARM7TDMI<T, Policy>::thumbUndefined;
 		} else if constexpr ((lutFillIndex & thumbSoftwareInterruptMask) == thumbSoftwareInterruptBits) {
-			return &ARM7TDMI<T>::thumbSoftwareInterrupt;
+			return &ARM7TDMI<T, Policy>::thumbSoftwareInterrupt;
 		} else if constexpr ((lutFillIndex & thumbConditionalBranchMask) == thumbConditionalBranchBits) {
-			return &ARM7TDMI<T>::thumbConditionalBranch<((lutFillIndex & 0b0000'1111'00) >> 2)>;
+			return &ARM7TDMI<T, Policy>::thumbConditionalBranch<((lutFillIndex & 0b0000'1111'00) >> 2)>;
 		} else if constexpr ((lutFillIndex & thumbUnconditionalBranchMask) == thumbUnconditionalBranchBits) {
-			return &ARM7TDMI<T>::thumbUnconditionalBranch;
+			return &ARM7TDMI<T, Policy>::thumbUnconditionalBranch;
 		} else if constexpr ((lutFillIndex & thumbUndefined2Mask) == thumbUndefined2Bits) {
-			return &ARM7TDMI<T>::thumbUndefined;
+			return &ARM7TDMI<T, Policy>::thumbUndefined;
 		} else if constexpr ((lutFillIndex & thumbLongBranchLinkMask) == thumbLongBranchLinkBits) {
-			return &ARM7TDMI<T>::thumbLongBranchLink<(bool)(lutFillIndex & 0b0000'1000'00)>;
+			return &ARM7TDMI<T, Policy>::thumbLongBranchLink<(bool)(lutFillIndex & 0b0000'1000'00)>;
 		}
 
-		return &ARM7TDMI<T>::unknownOpcodeThumb;
+		return &ARM7TDMI<T, Policy>::unknownOpcodeThumb;
 	}
 	template <std::size_t... lutFillIndex>
 	constexpr static std::array<thumbLutEntry, 1024> generateTableThumb(std::index_sequence<lutFillIndex...>) {
@@ -1775,4 +2370,249 @@ public:
 	constexpr static const std::array<thumbLutEntry, 1024> thumbLUT = {
 		generateTableThumb(std::make_index_sequence<1024>())
 	};
+
+#ifdef ARM7TDMI_TRACE_ACCESSES
+	/* Access Tracing */
+	// With ARM7TDMI_TRACE_ACCESSES every data access made by an instruction is pushed to accessTrace while it is set.
+	// Something should drain the ring (e.g. an AccessTraceWriter). The core waits for an attached consumer when the ring
+	// is full, and drops records (see AccessTraceRing::dropped()) when none is attached.
+	// Cycles come from the core with ARM7TDMI_LOCAL_CYCLES, otherwise from the bus's cycleCount() if it has one.
+	AccessTraceRing *accessTrace = nullptr;
+
+	void traceAccess(u32 address, u32 value, u8 size, bool write) {
+		if (!accessTrace)
+			return;
+
+		AccessRecord record;
+#ifdef ARM7TDMI_LOCAL_CYCLES
+		record.cycle = cycles;
+#else
+		if constexpr (requires (T& b) { { b.cycleCount() } -> std::convertible_to<u64>; }) {
+			flushPendingCycles();
+			record.cycle = bus.cycleCount();
+		} else {
+			record.cycle = 0;
+		}
+#endif
+		record.address = address;
+		record.value = value;
+		record.pc = reg.R[15] - (reg.thumbMode ? 6 : 12); // Handlers have fetched the next opcode by the time they access memory
+		record.size = size;
+		record.write = write;
+		record.reserved = 0;
+		accessTrace->push(record);
+	}
+#endif
+
+	/* Code Pages */
+	// One bit per 4KB page code was fetched from, in a two-level table of lazily allocated bitmaps. Pages are marked by
+	// fetches that refill the pipeline or run into a new page, and only if something acts on their writes: the bus's
+	// optional codeModified() hook, or ARM7TDMI_SMC_CHECK. codeWritten() unmarks a written page and passes its address to
+	// codeModified(), so anything that caches guest code can follow. The bus calls it for writes the core doesn't see
+	// (DMA, file loads). With ARM7TDMI_SMC_CHECK every data write made by the core checks the bitmap too.
+	static constexpr std::size_t CODE_PAGE_BITS = 12;
+	static constexpr std::size_t CODE_PAGE_MASK = (1 << CODE_PAGE_BITS) - 1;
+	static constexpr std::size_t CODE_BMP_BITS = 12;
+	static constexpr std::size_t CODE_BMP_SIZE = 1 << CODE_BMP_BITS;
+	static constexpr std::size_t CODE_TABLE_SIZE = 1 << (32 - CODE_PAGE_BITS - CODE_BMP_BITS);
+	std::vector<std::unique_ptr<std::bitset<CODE_BMP_SIZE>>> codePagesTable;
+
+	static constexpr bool codeModifiedHook() {
+		return requires (T& b, u32 address) { b.codeModified(address); };
+	}
+
+	static constexpr bool trackCodePages() {
+#ifdef ARM7TDMI_SMC_CHECK
+		return true;
+#else
+		return codeModifiedHook();
+#endif
+	}
+
+	bool isCodePage(u32 address) {
+		const auto& bitmap = codePagesTable[address >> (CODE_PAGE_BITS + CODE_BMP_BITS)];
+		return bitmap && bitmap->test((address >> CODE_PAGE_BITS) & (CODE_BMP_SIZE - 1));
+	}
+
+	void markCodePage(u32 address) {
+		auto& bitmap = codePagesTable[address >> (CODE_PAGE_BITS + CODE_BMP_BITS)];
+		if (!bitmap)
+			bitmap = std::make_unique<std::bitset<CODE_BMP_SIZE>>();
+		bitmap->set((address >> CODE_PAGE_BITS) & (CODE_BMP_SIZE - 1));
+	}
+
+	// size is in bytes, the range may span several pages. The pages being executed and fetched from stay marked, since
+	// sequential fetches wouldn't mark them again.
+	void codeWritten(u32 address, u32 size = 1) {
+		u32 last = address + size - 1;
+		u32 executingPage = (reg.R[15] - (reg.thumbMode ? 4 : 8)) >> CODE_PAGE_BITS;
+		u32 fetchPage = reg.R[15] >> CODE_PAGE_BITS;
+		for (u32 page = address >> CODE_PAGE_BITS; page <= (last >> CODE_PAGE_BITS); page++) {
+			auto& bitmap = codePagesTable[page >> CODE_BMP_BITS];
+			if (!bitmap || !bitmap->test(page & (CODE_BMP_SIZE - 1))) [[likely]]
+				continue;
+
+			if ((page != executingPage) && (page != fetchPage)) {
+				bitmap->reset(page & (CODE_BMP_SIZE - 1));
+				if (bitmap->none())
+					bitmap.reset();
+			}
+			if constexpr (codeModifiedHook())
+				bus.codeModified(page << CODE_PAGE_BITS);
+		}
+	}
+
+
+	/* Idle Loop Detection */
+	// Enabled when the bus provides bool isVolatile(u32 address) and void idleLoop(u32 address).
+	// A short backward branch taken twice with identical registers, with no stores and only volatile reads in between,
+	// can only leave the loop once something outside the core changes, so the bus gets a chance to skip ahead to its next event.
+	// The hook may call requestExit() to break out of runUntil()/runFor().
+	static constexpr bool detectIdleLoops() {
+		return requires (T& b, u32 address) {
+			{ b.isVolatile(address) } -> std::convertible_to<bool>;
+			b.idleLoop(address);
+		};
+	}
+
+	static constexpr i32 IDLE_LOOP_MAX_LENGTH = 32; // In bytes, measured back from the branch's PC
+	struct {
+		bool tracking;
+		u32 target;
+		u32 CPSR;
+		u32 R[15];
+	} idleLoop;
+
+	void checkIdleLoop(u32 target, i32 offset) {
+		if constexpr (detectIdleLoops()) {
+			if ((offset >= 0) || (offset < -IDLE_LOOP_MAX_LENGTH))
+				return;
+
+			if (idleLoop.tracking && (idleLoop.target == target) && (idleLoop.CPSR == getCPSR()) && !memcmp(idleLoop.R, reg.R, sizeof(idleLoop.R))) {
+				bus.idleLoop(target);
+				return;
+			}
+
+			idleLoop.tracking = true;
+			idleLoop.target = target;
+			idleLoop.CPSR = getCPSR();
+			memcpy(idleLoop.R, reg.R, sizeof(idleLoop.R));
+		}
+	}
+
+	/* Cycle Counting */
+	// Time spent in internal cycles, and every access timed by the core itself, is charged here
+	template <typename TT> static u32 timingCycles(const AccessTiming& timing, bool sequential) {
+		if constexpr (sizeof(TT) == 4) {
+			return sequential ? timing.sequential32 : timing.nonsequential32;
+		} else {
+			return sequential ? timing.sequential16 : timing.nonsequential16;
+		}
+	}
+
+	void internalCycles(int count) {
+#ifdef ARM7TDMI_LOCAL_CYCLES
+		cycles += count;
+#else
+		bus.iCycle(count);
+#endif
+	}
+
+	// An access the core served without the bus. cost comes from the fetch region or fastmem page, and is
+	// replaced by the region timing table when the core keeps its own time.
+	template <typename TT> void directAccessCycles(u32 address, bool sequential, u32 cost) {
+#ifdef ARM7TDMI_LOCAL_CYCLES
+		accessCycles<TT>(address, sequential);
+#else
+		pendingCycles += cost;
+#endif
+	}
+
+	// Accesses that go through the bus are only timed here when the core keeps its own time
+	template <typename TT> void accessCycles([[maybe_unused]] u32 address, [[maybe_unused]] bool sequential) {
+#ifdef ARM7TDMI_LOCAL_CYCLES
+		cycles += timingCycles<TT>(regionTiming[address >> 24], sequential);
+#endif
+	}
+
+	void blockCycles([[maybe_unused]] u32 address, [[maybe_unused]] int count) {
+#ifdef ARM7TDMI_LOCAL_CYCLES
+		const AccessTiming& timing = regionTiming[address >> 24];
+		cycles += timing.nonsequential32 + ((count - 1) * timing.sequential32);
+#endif
+	}
+
+	static constexpr bool deadlineHook() {
+		return requires (T& b) { b.deadlineReached(); };
+	}
+
+	void checkDeadline() {
+#ifdef ARM7TDMI_LOCAL_CYCLES
+		if constexpr (deadlineHook()) {
+			if (cycles >= cycleDeadline) [[unlikely]]
+				bus.deadlineReached();
+		}
+#endif
+	}
+
+#ifdef ARM7TDMI_LOCAL_CYCLES
+	// With ARM7TDMI_LOCAL_CYCLES the core keeps time itself instead of calling bus.iCycle(), and bus.read()/write() must not
+	// count cycles. Accesses are charged from regionTiming[], indexed by address bits 24-31 and filled in by the bus.
+	// bus.deadlineReached() is called at the first instruction boundary where cycles >= cycleDeadline,
+	// and is expected to move the deadline with setDeadline(). A bus without the hook has no deadline.
+	u64 cycles = 0;
+	u64 cycleDeadline = ~(u64)0;
+	std::array<AccessTiming, 256> regionTiming = {};
+
+	void setRegionTiming(u32 firstRegion, u32 lastRegion, AccessTiming timing) {
+		for (u32 region = firstRegion; region <= lastRegion; region++)
+			regionTiming[region] = timing;
+	}
+
+	void setDeadline(u64 deadline) {
+		cycleDeadline = deadline;
+	}
+#endif
+
+#ifdef ARM7TDMI_FASTMEM
+	/* Fastmem */
+	// Page table of host memory the bus has registered with mapMemory(). Loads and stores that hit a mapped page are
+	// served here and timed from the page's AccessTiming, everything else still goes to the bus.
+	static constexpr u32 FASTMEM_PAGE_BITS = 12;
+	static constexpr u32 FASTMEM_PAGE_SIZE = 1 << FASTMEM_PAGE_BITS;
+	static constexpr u32 FASTMEM_PAGE_MASK = FASTMEM_PAGE_SIZE - 1;
+
+	struct FastmemPage {
+		u8 *read; // Host memory backing the page, nullptr if reads go to the bus
+		u8 *write;
+		AccessTiming timing;
+	};
+	// First level covers 1MB per entry and is only filled in where something is mapped
+	std::array<std::unique_ptr<std::array<FastmemPage, 256>>, 4096> fastmemTable;
+
+	// start and size must be multiples of FASTMEM_PAGE_SIZE. memory has to stay valid until the range is unmapped
+	// or mapped again, so bank switches and mirrors just call this again with the new host pointer.
+	void mapMemory(u32 start, u32 size, u8 *memory, bool writable, AccessTiming timing) {
+		for (u32 offset = 0; offset < size; offset += FASTMEM_PAGE_SIZE) {
+			u32 address = start + offset;
+			auto& pages = fastmemTable[address >> 20];
+			if (!pages)
+				pages = std::make_unique<std::array<FastmemPage, 256>>();
+
+			FastmemPage& page = (*pages)[(address >> FASTMEM_PAGE_BITS) & 0xFF];
+			page.read = memory + offset;
+			page.write = writable ? (memory + offset) : nullptr;
+			page.timing = timing;
+		}
+	}
+
+	// Sends accesses in the range back to the bus
+	void unmapMemory(u32 start, u32 size) {
+		for (u32 offset = 0; offset < size; offset += FASTMEM_PAGE_SIZE) {
+			u32 address = start + offset;
+			if (auto& pages = fastmemTable[address >> 20])
+				(*pages)[(address >> FASTMEM_PAGE_BITS) & 0xFF] = {};
+		}
+	}
+#endif
 };
@@ -1,31 +1,115 @@
 #pragma once
 
 #include "../types.hpp"
+#include "../bus/concepts.hpp"
+#include "../scheduler/scheduler.hpp"
+#ifdef ARM946E_TRACE_ACCESSES
+#include "../trace/accesstrace.hpp"
+#endif
 #include "cp15.hpp"
+#include "cache.hpp"
+
+
+// Features picked at compile time. Cores with different policies can live in the same binary, so a frontend can run
+// ARM946E<Bus, ARM946EFastPolicy> and move over to ARM946E<Bus, ARM946EDebugPolicy> with loadState() once a debugger
+// attaches. ARM946E_DISABLE_DEBUG and ARM946E_DISABLE_FIQ only pick the default policy.
+struct ARM946EDefaultPolicy {
+#ifdef ARM946E_DISABLE_DEBUG
+	static constexpr bool debug = false;
+#else
+	static constexpr bool debug = true; // Breakpoints stop the core
+#endif
+#ifdef ARM946E_DISABLE_FIQ
+	static constexpr bool fiq = false;
+#else
+	static constexpr bool fiq = true; // Otherwise FIQs are never taken and the F bit always reads as set
+#endif
+};
 
-template <class T>
+struct ARM946EFastPolicy {
+	static constexpr bool debug = false;
+	static constexpr bool fiq = ARM946EDefaultPolicy::fiq;
+};
+
+struct ARM946EDebugPolicy {
+	static constexpr bool debug = true;
+	static constexpr bool fiq = ARM946EDefaultPolicy::fiq;
+};
+
+template <class T, class Policy = ARM946EDefaultPolicy>
 class ARM946E {
 public:
 	T& bus;
-	SystemControlCoprocessor cp15;
-	bool processFiq;
-	bool processIrq;
+
+	// Everything that needs a look between instructions, packed so the hot loops only test pendingWork & pendingMask.
+	// The bus raises the interrupt lines by writing processFiq/processIrq as before. pendingMask only lets a line through
+	// while its interrupt is unmasked, so one that stays raised inside a handler doesn't keep the slow path on.
+	// halted is shared with the coprocessor (cp15.halted refers to it), so a halt from either side is seen here.
+	union {
+		struct {
+			bool processFiq;
+			bool processIrq;
+			bool halted;
+			bool exitRequested;
+			bool breakpointsSet; // Any breakpoint exists
+			bool pendingUnused[3];
+		};
+		u64 pendingWork = 0;
+	};
+	static constexpr u64 PENDING_INTERRUPT_LINES = byteMask(0, 2); // processFiq and processIrq
+	static constexpr u64 PENDING_FIQ_LINE = byteMask(0, 1);
+	static constexpr u64 PENDING_IRQ_LINE = byteMask(1, 1);
+	u64 pendingMask = ~(u64)0;
+
+	// Has to be called after the I or F bit changes. setCPSR() and exception entry do it, anything else that writes
+	// the CPSR bits directly has to call it too.
+	void updatePendingMask() {
+		pendingMask = ~PENDING_INTERRUPT_LINES;
+		if (Policy::fiq && !reg.fiqDisable)
+			pendingMask |= PENDING_FIQ_LINE;
+		if (!reg.irqDisable)
+			pendingMask |= PENDING_IRQ_LINE;
+	}
+
+	SystemControlCoprocessor cp15{halted}; // After pendingWork, which holds its halted flag
 
 	/* User Functions */
+	// Breakpoints are one bit per address in 64KB bitmaps, found through a directory indexed by the top 8 address bits
+	// and a table for the next 8. Tables and bitmaps are only allocated once a breakpoint lands in them, so a core
+	// without breakpoints only carries the directory.
 	static constexpr std::size_t BMP_BITS = 16; // Thanks to BreadFish64 because I never would've come up with this breakpoint myself
-	static constexpr std::size_t TABLE_BITS = 32 - BMP_BITS;
+	static constexpr std::size_t DIR_BITS = 8;
+	static constexpr std::size_t TABLE_BITS = 32 - BMP_BITS - DIR_BITS;
 	static constexpr std::size_t BMP_SIZE = 1 << BMP_BITS;
 	static constexpr std::size_t TABLE_SIZE = 1 << TABLE_BITS;
+	static constexpr std::size_t DIR_SIZE = 1 << DIR_BITS;
 	static constexpr std::size_t BMP_MASK = BMP_SIZE - 1;
-	std::vector<std::unique_ptr<std::bitset<BMP_SIZE>>> breakpointsTable;
+	using BreakpointBitmap = std::bitset<BMP_SIZE>;
+	using BreakpointTable = std::array<std::unique_ptr<BreakpointBitmap>, TABLE_SIZE>;
+	std::array<std::unique_ptr<BreakpointTable>, DIR_SIZE> breakpointsTable;
 
-	ARM946E(T& bus) : bus(bus), breakpointsTable(TABLE_SIZE){};
+	ARM946E(T& bus) : bus(bus), codePagesTable(CODE_TABLE_SIZE) {
+		static_assert(ARM946EBus<T>, "The bus doesn't implement the interface in bus/concepts.hpp");
+	};
 
 	void resetARM946E()  {
 		cp15.reset();
+#ifdef ARM946E_INLINE_TCM
+		cp15.updateTcmRegions();
+#endif
+#ifdef ARM946E_MPU
+		cp15.updateProtectionMap();
+		dataAbort.pending = false;
+		dataAbort.saved = false;
+#endif
+#ifdef ARM946E_CACHE
+		instructionCache.invalidate();
+		dataCache.invalidate();
+#endif
 
 		processFiq = false;
 		processIrq = false;
+		exitRequested = false;
 
 		reg.R[0] = 0x00000000;
 		reg.R[1] = 0x00000000;
@@ -44,7 +128,7 @@ public:
 		reg.R[14] = 0x00000000;
 		reg.R[15] = (cp15.vectorOffset ? 0xFFFF0000 : 0x00000000);
 
-		reg.CPSR = 0x000000D3;
+		setCPSR(0x000000D3);
 
 		for (int i = 0; i < 8; i++) reg.R_usr[i] = 0x00000000;
 		for (int i = 0; i < 8; i++) reg.R_fiq[i] = 0x00000000;
@@ -53,65 +137,299 @@ public:
 		for (int i = 0; i < 8; i++) reg.R_irq[i] = 0x00000000;
 		for (int i = 0; i < 8; i++) reg.R_und[i] = 0x00000000;
 
+		codeRegion.size = 0;
+		pendingCycles = 0;
 		flushPipeline();
+		idleLoop.tracking = false;
 	}
 
-	void cycle() {
-		if (cp15.halted) {
-			if (processFiq || processIrq) {
-				cp15.halted = false;
+	// Carries on from where other stopped, on the same bus. This is how a running session moves from a Fast instance
+	// to a Debug one when a debugger attaches (and back when it detaches): other has to be stopped, and shouldn't run
+	// again until it gets the state back. Breakpoints stay with the instance they were added to. The cache
+	// contents are dropped and rebuilt as the code runs again, which the write-through data cache makes a timing
+	// difference only.
+	template <class OtherPolicy>
+	void loadState(ARM946E<T, OtherPolicy>& other) {
+		static_assert(Policy::fiq == OtherPolicy::fiq, "Both instances need the same FIQ support");
+
+		other.flushPendingCycles();
+		reg = std::bit_cast<decltype(reg)>(other.reg);
+		updatePendingMask();
+		pipelineOpcode1 = other.pipelineOpcode1;
+		pipelineOpcode2 = other.pipelineOpcode2;
+		pipelineOpcode3 = other.pipelineOpcode3;
+		nextFetchType = other.nextFetchType;
+
+		processFiq = other.processFiq;
+		processIrq = other.processIrq;
+		cp15.loadState(other.cp15);
+		exitRequested = false;
+#ifdef ARM946E_MPU
+		dataAbort.pending = false; // Never left pending between instructions
+		dataAbort.saved = false;
+#endif
+#ifdef ARM946E_CACHE
+		instructionCache.invalidate();
+		dataCache.invalidate();
+#endif
+#ifdef ARM946E_LOCAL_CYCLES
+		cycles = other.cycles;
+		cycleDeadline = other.cycleDeadline;
+		regionTiming = other.regionTiming;
+#endif
+#ifdef ARM946E_FASTMEM
+		for (std::size_t i = 0; i < fastmemTable.size(); i++) {
+			if (other.fastmemTable[i]) {
+				fastmemTable[i] = std::make_unique<std::array<FastmemPage, 256>>(std::bit_cast<std::array<FastmemPage, 256>>(*other.fastmemTable[i]));
 			} else {
-				return;
+				fastmemTable[i].reset();
 			}
 		}
-
-#ifndef ARM946E_DISABLE_FIQ
-		if(processFiq && !reg.fiqDisable) { [[unlikely]] // Service fast interrupt
-				serviceFiq();
-		} else
 #endif
-		if (processIrq && !reg.irqDisable) { [[unlikely]] // Service interrupt
-				serviceIrq();
-		} else {
-			if (reg.thumbMode) {
-				u16 lutIndex = pipelineOpcode3 >> 6;
-				(this->*thumbLUT[lutIndex])((u16)pipelineOpcode3);
-			} else {
-				u32 conditionCode = pipelineOpcode3 >> 28;
-				if (checkCondition(conditionCode)) {
-					u32 lutIndex = ((pipelineOpcode3 & 0x0FF00000) >> 16) | ((pipelineOpcode3 & 0x000000F0) >> 4);
+#ifdef ARM946E_TRACE_ACCESSES
+		accessTrace = other.accessTrace;
+#endif
 
-					if (conditionCode == 0xF) { [[unlikely]]
-						(this->*armLUT2[lutIndex])(pipelineOpcode3);
-					} else {
-						(this->*armLUT[lutIndex])(pipelineOpcode3);
-					}
+		idleLoop.tracking = false;
+		codeRegion.size = 0;
+		pendingCycles = 0;
+		for (auto& bitmap : codePagesTable)
+			bitmap.reset();
+	}
+
+	void cycle() {
+		if (pendingWork & pendingMask) [[unlikely]] {
+			if (halted) {
+				if (processFiq || processIrq) {
+					halted = false;
 				} else {
-					fetchOpcode();
+					return;
 				}
 			}
+
+			exitRequested = false; // Only runUntil() acts on it
+			stepInstruction();
+			checkBreakpoint();
+		} else {
+			executeInstruction();
+		}
+		flushPendingCycles();
+		checkDeadline();
+	}
+
+	enum runExitReason {
+		EXIT_PREDICATE,
+		EXIT_INTERRUPT, // An interrupt line changed
+		EXIT_BREAKPOINT,
+		EXIT_REQUESTED, // requestExit() was called
+		EXIT_HALTED
+	};
+	runExitReason runExit;
+	bool runFiqLine;
+	bool runIrqLine;
+	u64 runPendingWork; // pendingWork as long as nothing happens
+
+	// Can be called from bus callbacks to make runUntil()/runFor() return after the current instruction
+	void requestExit() { exitRequested = true; }
+
+	// Runs instructions back to back until predicate() returns true, without returning to the caller in between
+	template <typename Predicate>
+	runExitReason runUntil(Predicate predicate) {
+		runFiqLine = processFiq;
+		runIrqLine = processIrq;
+		exitRequested = false;
+		runPendingWork = pendingWork & PENDING_INTERRUPT_LINES;
+
+		if (halted) [[unlikely]] {
+			if (processFiq || processIrq) {
+				halted = false;
+			} else {
+				flushPendingCycles();
+				return predicate() ? EXIT_PREDICATE : EXIT_HALTED;
+			}
+		}
+
+		while (!predicate()) {
+			stepInstruction();
+			if (checkRunExit()) [[unlikely]] {
+				flushPendingCycles();
+				return runExit;
+			}
+		}
+
+		flushPendingCycles();
+		return EXIT_PREDICATE;
+	}
+
+	// Checked after every instruction inside runUntil()
+	bool checkRunExit() {
+		checkDeadline();
+		if (pendingWork == runPendingWork) [[likely]]
+			return false;
+
+		if (checkBreakpoint()) [[unlikely]] {
+			runExit = EXIT_BREAKPOINT;
+			return true;
+		}
+		if (halted) [[unlikely]] {
+			runExit = EXIT_HALTED;
+			return true;
+		}
+		if (exitRequested) [[unlikely]] {
+			runExit = EXIT_REQUESTED;
+			return true;
+		}
+		if (Policy::fiq && (processFiq != runFiqLine)) [[unlikely]] {
+			runExit = EXIT_INTERRUPT;
+			return true;
 		}
+		if (processIrq != runIrqLine) [[unlikely]] {
+			runExit = EXIT_INTERRUPT;
+			return true;
+		}
+		return false;
+	}
 
-#ifndef ARM946E_DISABLE_DEBUG
-		u32 nextInstrAddress = reg.R[15] - (reg.thumbMode ? 4 : 8);
-		// Again, this is too smart for me
-		if (const auto& breakpointBitmap = breakpointsTable[nextInstrAddress >> BMP_BITS];
-			breakpointBitmap && breakpointBitmap->test(nextInstrAddress & BMP_MASK)) { [[unlikely]]
-			bus.breakpoint();
+	// Runs until at least the given number of cycles have passed. Needs the bus to provide u64 cycleCount() unless ARM946E_LOCAL_CYCLES is set.
+	// Time spent halted is skipped in one go, EXIT_HALTED means the core was still asleep when the time ran out.
+	runExitReason runFor(u64 cycles) {
+		u64 endCycle = currentCycle() + cycles;
+		while (true) {
+			runExitReason reason = runUntil([&]() { return currentCycle() >= endCycle; });
+			if (reason != EXIT_HALTED)
+				return reason;
+
+			skipHalted(endCycle);
+			if (sleeping())
+				return EXIT_HALTED;
 		}
+	}
+
+	// Stops the core until processIrq or processFiq is raised, even if interrupts are disabled. Can be called from bus
+	// callbacks, runUntil() returns EXIT_HALTED after the current instruction.
+	void halt() {
+		halted = true;
+	}
+
+	// True if nothing will run until an interrupt line is raised
+	bool sleeping() {
+		return halted && !processFiq && !processIrq;
+	}
+
+	// Moves the clock up to target while sleeping, in one step (with ARM946E_LOCAL_CYCLES, one per deadline so the bus
+	// can raise an interrupt in between)
+	void skipHalted(u64 target) {
+#ifdef ARM946E_LOCAL_CYCLES
+		while (sleeping() && (cycles < target)) {
+			cycles = (cycleDeadline > cycles) ? std::min(cycleDeadline, target) : target;
+			checkDeadline();
+		}
+#else
+		u64 now = currentCycle();
+		if (sleeping() && (target > now))
+			bus.iCycle(target - now);
+#endif
+	}
+
+	// The core's clock, in the same units as runFor()
+	u64 currentCycle() {
+#ifdef ARM946E_LOCAL_CYCLES
+		return cycles;
+#else
+		flushPendingCycles();
+		return bus.cycleCount();
 #endif
 	}
 
+	// Runs until the clock reaches endCycle, stopping at every event's timestamp to let the scheduler run it. Events
+	// scheduled from bus callbacks while running are picked up right away, and IRQ/FIQ lines raised by event callbacks
+	// are seen before the next instruction. Returns early on breakpoints and requestExit().
+	runExitReason runScheduled(Scheduler& scheduler, u64 endCycle) {
+		while (true) {
+			u64 now = currentCycle();
+			scheduler.runEvents(now);
+			if (now >= endCycle)
+				return EXIT_PREDICATE;
+
+			runExitReason reason = runUntil([&]() { return currentCycle() >= std::min(scheduler.nextEventTime(), endCycle); });
+			if ((reason == EXIT_BREAKPOINT) || (reason == EXIT_REQUESTED))
+				return reason;
+			if (reason == EXIT_HALTED) { // Nothing happens until an event wakes the core up
+				u64 target = std::min(scheduler.nextEventTime(), endCycle);
+				if (sleeping() && (target == Scheduler::NEVER))
+					return EXIT_HALTED;
+				skipHalted(target);
+			}
+		}
+	}
+
+	void stepInstruction() {
+		if (pendingWork & pendingMask) [[unlikely]] {
+			if (Policy::fiq && processFiq && !reg.fiqDisable) { // Service fast interrupt
+				serviceFiq();
+				return;
+			}
+			if (processIrq && !reg.irqDisable) { // Service interrupt
+				serviceIrq();
+				return;
+			}
+		}
+
+		executeInstruction();
+	}
+
+	bool interruptPending() {
+		if (!(pendingWork & pendingMask)) [[likely]]
+			return false;
+		if (Policy::fiq && processFiq && !reg.fiqDisable)
+			return true;
+		return processIrq && !reg.irqDisable;
+	}
+
+	// Returns true if execution should stop because a breakpoint was hit
+	bool checkBreakpoint() {
+		if constexpr (Policy::debug) {
+			if (!breakpointsSet) [[likely]]
+				return false;
+
+			u32 nextInstrAddress = reg.R[15] - (reg.thumbMode ? 4 : 8);
+			// Again, this is too smart for me
+			if (const BreakpointBitmap *breakpointBitmap = findBreakpointBitmap(nextInstrAddress);
+				breakpointBitmap && breakpointBitmap->test(nextInstrAddress & BMP_MASK)) { [[unlikely]]
+				bus.breakpoint();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	BreakpointBitmap *findBreakpointBitmap(u32 address) {
+		const auto& table = breakpointsTable[address >> (BMP_BITS + TABLE_BITS)];
+		return table ? (*table)[(address >> BMP_BITS) & (TABLE_SIZE - 1)].get() : nullptr;
+	}
+
+	// Any instance keeps breakpoints, only ones with Policy::debug stop on them
 	void addBreakpoint(u32 address) {
-		auto& page = breakpointsTable[address >> BMP_BITS];
+		auto& table = breakpointsTable[address >> (BMP_BITS + TABLE_BITS)];
+		if (!table) {
+			table = std::make_unique<BreakpointTable>();
+		}
+
+		auto& page = (*table)[(address >> BMP_BITS) & (TABLE_SIZE - 1)];
 		if (!page) {
-			page = std::make_unique<std::bitset<BMP_SIZE>>();
+			page = std::make_unique<BreakpointBitmap>();
 		}
 		page->set(address & BMP_MASK);
+		breakpointsSet = Policy::debug;
 	}
 
 	void removeBreakpoint(u32 address) {
-		auto& page = breakpointsTable[address >> BMP_BITS];
+		auto& table = breakpointsTable[address >> (BMP_BITS + TABLE_BITS)];
+		if (!table) {
+			return;
+		}
+
+		auto& page = (*table)[(address >> BMP_BITS) & (TABLE_SIZE - 1)];
 		if (!page) {
 			return;
 		}
@@ -119,6 +437,10 @@ public:
 		page->reset(address & BMP_MASK);
 		if (page->none()) {
 			page.reset();
+			if (std::none_of(table->begin(), table->end(), [](const auto& bitmap) { return (bool)bitmap; })) {
+				table.reset();
+				breakpointsSet = Policy::debug && std::any_of(breakpointsTable.begin(), breakpointsTable.end(), [](const auto& table) { return (bool)table; });
+			}
 		}
 	}
 
@@ -144,24 +466,103 @@ public:
 				u32 irqDisable : 1;
 				u32 : 19;
 				u32 flagQ : 1;
-				u32 flagV : 1;
-				u32 flagC : 1;
-				u32 flagZ : 1;
-				u32 flagN : 1;
+				u32 : 4;
 			};
-			u32 CPSR;
+			u32 controlBits; // CPSR without NZCV, use getCPSR() and setCPSR() for the whole register
 		};
 
-		// Banked registers for each mode
-		// Indexes 0-6 are R8-R14, 7 is SPSR
-		u32 R_usr[8];
-		u32 R_fiq[8];
-		u32 R_svc[8];
-		u32 R_abt[8];
-		u32 R_irq[8];
-		u32 R_und[8];
+		// Condition flags live outside the CPSR word so they can be set without a read-modify-write
+		bool flagN;
+		bool flagZ;
+		bool flagC;
+		bool flagV;
+
+		// Banked registers for each mode, indexed by modeBank[]
+		// Indexes 0-6 are R8-R14, 7 is SPSR. The slots of the current mode are stale until it is left.
+		union {
+			u32 R_bank[6][8];
+			struct {
+				u32 R_usr[8]; // Also used by system mode, and holds R8-R12 for every mode except FIQ
+				u32 R_fiq[8];
+				u32 R_svc[8];
+				u32 R_abt[8];
+				u32 R_irq[8];
+				u32 R_und[8];
+			};
+		};
 	} reg;
 
+	enum registerBank : i8 {
+		BANK_INVALID = -1,
+		BANK_USR,
+		BANK_FIQ,
+		BANK_SVC,
+		BANK_ABT,
+		BANK_IRQ,
+		BANK_UND
+	};
+	static constexpr std::array<registerBank, 32> modeBank = [] {
+		std::array<registerBank, 32> table;
+		table.fill(BANK_INVALID);
+		table[MODE_USER] = BANK_USR;
+		table[MODE_FIQ] = BANK_FIQ;
+		table[MODE_IRQ] = BANK_IRQ;
+		table[MODE_SUPERVISOR] = BANK_SVC;
+		table[MODE_ABORT] = BANK_ABT;
+		table[MODE_UNDEFINED] = BANK_UND;
+		table[MODE_SYSTEM] = BANK_USR;
+		return table;
+	}();
+
+	// SPSR of the current mode, nullptr in user and system mode
+	u32 *currentSPSR() {
+		registerBank bank = modeBank[reg.mode];
+		return (bank > BANK_USR) ? &reg.R_bank[bank][7] : nullptr;
+	}
+
+	u32 getCPSR() {
+		return reg.controlBits | ((u32)reg.flagN << 31) | ((u32)reg.flagZ << 30) | ((u32)reg.flagC << 29) | ((u32)reg.flagV << 28);
+	}
+
+	void setCPSR(u32 value) {
+		reg.controlBits = value & 0x0FFFFFFF;
+		reg.flagN = (value >> 31) & 1;
+		reg.flagZ = (value >> 30) & 1;
+		reg.flagC = (value >> 29) & 1;
+		reg.flagV = (value >> 28) & 1;
+		updatePendingMask();
+	}
+
+	/* Flags */
+	// Sets all of NZCV
+	void setFlags(u32 result, bool carry, bool overflow) {
+		reg.flagN = result >> 31;
+		reg.flagZ = result == 0;
+		reg.flagC = carry;
+		reg.flagV = overflow;
+	}
+
+	// N and Z from the result, V is left alone
+	void setFlagsLogical(u32 result, bool carry) {
+		reg.flagN = result >> 31;
+		reg.flagZ = result == 0;
+		reg.flagC = carry;
+	}
+
+	// N and Z from the result, C and V are left alone
+	void setFlagsNZ(u32 result) {
+		reg.flagN = result >> 31;
+		reg.flagZ = result == 0;
+	}
+
+	void setFlagsAdd(u32 operand1, u32 operand2, u32 result) {
+		setFlags(result, result < operand1, (~(operand1 ^ operand2) & (operand1 ^ result)) >> 31);
+	}
+
+	void setFlagsSub(u32 operand1, u32 operand2, u32 result) {
+		setFlags(result, operand1 >= operand2, ((operand1 ^ operand2) & (operand1 ^ result)) >> 31);
+	}
+
 	/* Instruction Fetch/Decode */
 	u32 pipelineOpcode1; // R15
 	u32 pipelineOpcode2; // R15 + 4
@@ -203,6 +604,7 @@ public:
 		reg.irqDisable = true;
 		reg.fiqDisable = true;
 		reg.thumbMode = false;
+		updatePendingMask();
 
 		reg.R[15] = (cp15.vectorOffset ? 0xFFFF0000 : 0x00000000) | 0x1C;
 		flushPipeline();
@@ -219,25 +621,139 @@ public:
 		reg.irqDisable = true;
 		reg.fiqDisable = true;
 		reg.thumbMode = false;
+		updatePendingMask();
 
 		reg.R[15] = (cp15.vectorOffset ? 0xFFFF0000 : 0x00000000) | 0x18;
 		flushPipeline();
 	}
 
+	void executeInstruction() {
+		if (reg.thumbMode) {
+			u16 lutIndex = pipelineOpcode3 >> 6;
+			(this->*thumbLUT[lutIndex])((u16)pipelineOpcode3);
+		} else {
+			u32 conditionCode = pipelineOpcode3 >> 28;
+			if (checkCondition(conditionCode)) {
+				u32 lutIndex = ((pipelineOpcode3 & 0x0FF00000) >> 16) | ((pipelineOpcode3 & 0x000000F0) >> 4);
+
+				if (conditionCode == 0xF) { [[unlikely]]
+					(this->*armLUT2[lutIndex])(pipelineOpcode3);
+				} else {
+					(this->*armLUT[lutIndex])(pipelineOpcode3);
+				}
+			} else {
+				fetchOpcode();
+			}
+		}
+	}
+
+	// Opcode fetches go through here. Sequential fetches inside the bus's current FetchRegion skip bus.read()
+	// and have their cycles handed to bus.iCycle() in bulk, before the next bus access or when the run returns.
+	static constexpr bool directFetch() {
+		return requires (T& b, u32 address, FetchRegion& region) {
+			{ b.fetchRegion(address, region) } -> std::convertible_to<bool>;
+		};
+	}
+
+	// True if some accesses are timed by the core and have to be handed to the bus later
+	static constexpr bool deferCycles() {
+#if defined(ARM946E_LOCAL_CYCLES)
+		return false;
+#elif defined(ARM946E_FASTMEM) || defined(ARM946E_INLINE_TCM) || defined(ARM946E_CACHE)
+		return true;
+#else
+		return directFetch();
+#endif
+	}
+
+	FetchRegion codeRegion;
+	u32 pendingCycles;
+
+	template <typename TT> TT fetchCode(u32 address, bool sequential) {
+#ifdef ARM946E_MPU
+		if (!accessAllowed(address, cp15.PROTECTION_EXECUTE)) [[unlikely]]
+			return (sizeof(TT) == 2) ? 0xBE00 : 0xE1200070; // BKPT, see Memory Protection
+#endif
+		if constexpr (trackCodePages()) {
+			if (!sequential || !(address & CODE_PAGE_MASK))
+				markCodePage(address);
+		}
+#ifdef ARM946E_INLINE_TCM
+		if ((address < cp15.itcmEnd) && cp15.itcmReadable) {
+			TT opcode;
+			memcpy(&opcode, cp15.itcm + (address & 0x7FFF & ~(sizeof(TT) - 1)), sizeof(TT));
+			coreSpeedCycles();
+			return opcode;
+		}
+#endif
+#ifdef ARM946E_CACHE
+		if (instructionCacheable(address)) {
+			TT opcode;
+			memcpy(&opcode, cacheLine<true>(instructionCache, address) + (address & 0x1F & ~(sizeof(TT) - 1)), sizeof(TT));
+			return opcode;
+		}
+#endif
+		if constexpr (directFetch()) {
+			u32 offset = address - codeRegion.start;
+			if (offset < codeRegion.size) [[likely]] {
+				if (sequential) [[likely]] {
+					TT opcode;
+					memcpy(&opcode, codeRegion.memory + offset, sizeof(TT));
+					directAccessCycles<TT>(address, true, (sizeof(TT) == 2) ? codeRegion.cycles16 : codeRegion.cycles32);
+					return opcode;
+				}
+			} else {
+				flushPendingCycles();
+				if (!bus.fetchRegion(address, codeRegion))
+					codeRegion.size = 0;
+			}
+		}
+		accessCycles<TT>(address, sequential);
+		return bus.template read<TT, true>(address, sequential);
+	}
+
+	void flushPendingCycles() {
+		if constexpr (deferCycles()) {
+			if (pendingCycles) {
+				bus.iCycle(pendingCycles);
+				pendingCycles = 0;
+			}
+		}
+	}
+
+	// Has to be called by the bus when memory behind the current FetchRegion is remapped
+	void invalidateFetchRegion() {
+		flushPendingCycles();
+		codeRegion.size = 0;
+	}
+
+	// With ARM946E_PIPELINE_FREE only the opcode that runs next is fetched, and flushes take one read instead of two.
+	// R15 still reads as PC + 8/PC + 4, but stores into the next two instructions are seen right away and code fetch
+	// timing no longer matches the hardware.
 	void fetchOpcode() {
+#ifdef ARM946E_PIPELINE_FREE
+		if (reg.thumbMode) {
+			reg.R[15] += 2;
+			pipelineOpcode3 = fetchCode<u16>(reg.R[15] - 4, nextFetchType);
+		} else {
+			reg.R[15] += 4;
+			pipelineOpcode3 = fetchCode<u32>(reg.R[15] - 8, nextFetchType);
+		}
+#else
 		if (reg.thumbMode) {
-			pipelineOpcode1 = bus.template read<u16, true>(reg.R[15], nextFetchType);
+			pipelineOpcode1 = fetchCode<u16>(reg.R[15], nextFetchType);
 			pipelineOpcode3 = pipelineOpcode2;
 			pipelineOpcode2 = pipelineOpcode1;
 
 			reg.R[15] += 2;
 		} else {
-			pipelineOpcode1 = bus.template read<u32, true>(reg.R[15], nextFetchType);
+			pipelineOpcode1 = fetchCode<u32>(reg.R[15], nextFetchType);
 			pipelineOpcode3 = pipelineOpcode2;
 			pipelineOpcode2 = pipelineOpcode1;
 
 			reg.R[15] += 4;
 		}
+#endif
 
 		nextFetchType = true;
 	}
@@ -248,12 +764,16 @@ public:
 
 		if (reg.thumbMode) {
 			reg.R[15] = (reg.R[15] & ~1) + 4;
-			pipelineOpcode3 = bus.template read<u16, true>(reg.R[15] - 4, false);
-			pipelineOpcode2 = bus.template read<u16, true>(reg.R[15] - 2, true);
+			pipelineOpcode3 = fetchCode<u16>(reg.R[15] - 4, false);
+#ifndef ARM946E_PIPELINE_FREE
+			pipelineOpcode2 = fetchCode<u16>(reg.R[15] - 2, true);
+#endif
 		} else {
 			reg.R[15] = (reg.R[15] & ~3) + 8;
-			pipelineOpcode3 = bus.template read<u32, true>(reg.R[15] - 8, false);
-			pipelineOpcode2 = bus.template read<u32, true>(reg.R[15] - 4, true);
+			pipelineOpcode3 = fetchCode<u32>(reg.R[15] - 8, false);
+#ifndef ARM946E_PIPELINE_FREE
+			pipelineOpcode2 = fetchCode<u32>(reg.R[15] - 4, true);
+#endif
 		}
 
 		nextFetchType = true;
@@ -279,6 +799,181 @@ public:
 	}
 
 	/* Helper Functions */
+	// LDM/STM/PUSH/POP try these first. They return false when the bus has no readBlock()/writeBlock() hooks or
+	// refuses the range (e.g. it crosses into another region), and the caller falls back to one access per register.
+	static constexpr bool blockTransfers() {
+		return requires (T& b, u32 address, u32 *values, const u32 *constValues, int count) {
+			{ b.readBlock(address, values, count) } -> std::convertible_to<bool>;
+			{ b.writeBlock(address, constValues, count) } -> std::convertible_to<bool>;
+		};
+	}
+
+	bool dataReadBlock(u32 address, u32 *values, int count) {
+#ifdef ARM946E_MPU
+		// Loads can overwrite the base register, so the whole range is checked before anything is loaded
+		if (!accessAllowed(address, cp15.PROTECTION_READ) || !accessAllowed(address + (count - 1) * 4, cp15.PROTECTION_READ)) [[unlikely]] {
+			abortAccess();
+			memset(values, 0, count * sizeof(u32));
+			return true;
+		}
+#endif
+		if constexpr (blockTransfers()) {
+#ifdef ARM946E_INLINE_TCM
+			if (tcmPointer(address, false) || tcmPointer(address + (count - 1) * 4, false))
+				return false;
+#endif
+#ifdef ARM946E_CACHE
+			if (dataCacheable(address) || dataCacheable(address + (count - 1) * 4))
+				return false;
+#endif
+			flushPendingCycles();
+			if constexpr (detectIdleLoops())
+				idleLoop.tracking = false;
+			if (!bus.readBlock(address, values, count))
+				return false;
+#ifdef ARM946E_TRACE_ACCESSES
+			for (int i = 0; i < count; i++)
+				traceAccess(address + (i * 4), values[i], 4, false);
+#endif
+			blockCycles(address, count);
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+	bool dataWriteBlock(u32 address, const u32 *values, int count) {
+		if constexpr (blockTransfers()) {
+#ifdef ARM946E_MPU
+			if (!accessAllowed(address, cp15.PROTECTION_WRITE) || !accessAllowed(address + (count - 1) * 4, cp15.PROTECTION_WRITE))
+				return false; // One store at a time, so the ones before the protected page still happen
+#endif
+#ifdef ARM946E_INLINE_TCM
+			if (tcmPointer(address, true) || tcmPointer(address + (count - 1) * 4, true))
+				return false;
+#endif
+#ifdef ARM946E_CACHE
+			if (dataCacheable(address) || dataCacheable(address + (count - 1) * 4))
+				return false;
+#endif
+			flushPendingCycles();
+			if constexpr (detectIdleLoops())
+				idleLoop.tracking = false;
+			if (!bus.writeBlock(address, values, count))
+				return false;
+#ifdef ARM946E_TRACE_ACCESSES
+			for (int i = 0; i < count; i++)
+				traceAccess(address + (i * 4), values[i], 4, true);
+#endif
+#ifdef ARM946E_SMC_CHECK
+			codeWritten(address, count * 4);
+#endif
+			blockCycles(address, count);
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+	// All data accesses made by instructions go through these so the core can watch them
+	template <typename TT> TT dataRead(u32 address, bool sequential) {
+		TT value = memoryRead<TT>(address, sequential);
+#ifdef ARM946E_TRACE_ACCESSES
+		traceAccess(address, value, sizeof(TT), false);
+#endif
+		return value;
+	}
+
+	template <typename TT> void dataWrite(u32 address, TT value, bool sequential) {
+#ifdef ARM946E_TRACE_ACCESSES
+		traceAccess(address, value, sizeof(TT), true);
+#endif
+		memoryWrite<TT>(address, value, sequential);
+	}
+
+	template <typename TT> TT memoryRead(u32 address, bool sequential) {
+#ifdef ARM946E_MPU
+		if (dataAbort.pending || !accessAllowed(address, cp15.PROTECTION_READ)) [[unlikely]] {
+			abortAccess();
+			return 0;
+		}
+#endif
+		if constexpr (detectIdleLoops()) {
+			if (idleLoop.tracking && !bus.isVolatile(address))
+				idleLoop.tracking = false;
+		}
+#ifdef ARM946E_INLINE_TCM
+		if (u8 *tcm = tcmPointer(address & ~(sizeof(TT) - 1), false)) {
+			TT value;
+			memcpy(&value, tcm, sizeof(TT));
+			coreSpeedCycles();
+			return value;
+		}
+#endif
+#ifdef ARM946E_CACHE
+		if (dataCacheable(address)) {
+			TT value;
+			memcpy(&value, cacheLine<false>(dataCache, address) + (address & 0x1F & ~(sizeof(TT) - 1)), sizeof(TT));
+			return value;
+		}
+#endif
+#ifdef ARM946E_FASTMEM
+		if (const auto& pages = fastmemTable[address >> 20]) {
+			FastmemPage& page = (*pages)[(address >> FASTMEM_PAGE_BITS) & 0xFF];
+			if (page.read) {
+				TT value;
+				memcpy(&value, page.read + (address & FASTMEM_PAGE_MASK & ~(sizeof(TT) - 1)), sizeof(TT));
+				directAccessCycles<TT>(address, sequential, timingCycles<TT>(page.timing, sequential));
+				return value;
+			}
+		}
+#endif
+		flushPendingCycles();
+		accessCycles<TT>(address, sequential);
+		return bus.template read<TT, false>(address, sequential);
+	}
+
+	template <typename TT> void memoryWrite(u32 address, TT value, bool sequential) {
+#ifdef ARM946E_MPU
+		if (dataAbort.pending || !accessAllowed(address, cp15.PROTECTION_WRITE)) [[unlikely]] {
+			abortAccess();
+			return;
+		}
+#endif
+		if constexpr (detectIdleLoops())
+			idleLoop.tracking = false;
+#ifdef ARM946E_SMC_CHECK
+		if (isCodePage(address)) [[unlikely]]
+			codeWritten(address, sizeof(TT));
+#endif
+#ifdef ARM946E_INLINE_TCM
+		if (u8 *tcm = tcmPointer(address & ~(sizeof(TT) - 1), true)) {
+			memcpy(tcm, &value, sizeof(TT));
+			coreSpeedCycles();
+			return;
+		}
+#endif
+#ifdef ARM946E_CACHE
+		if (dataCacheable(address)) { // Write-through, the bus still gets the store
+			if (u8 *line = dataCache.find(address))
+				memcpy(line + (address & 0x1F & ~(sizeof(TT) - 1)), &value, sizeof(TT));
+		}
+#endif
+#ifdef ARM946E_FASTMEM
+		if (const auto& pages = fastmemTable[address >> 20]) {
+			FastmemPage& page = (*pages)[(address >> FASTMEM_PAGE_BITS) & 0xFF];
+			if (page.write) {
+				memcpy(page.write + (address & FASTMEM_PAGE_MASK & ~(sizeof(TT) - 1)), &value, sizeof(TT));
+				directAccessCycles<TT>(address, sequential, timingCycles<TT>(page.timing, sequential));
+				return;
+			}
+		}
+#endif
+		flushPendingCycles();
+		accessCycles<TT>(address, sequential);
+		bus.template write<TT>(address, value, sequential);
+	}
+
 	template <typename TT> u32 rotateMisaligned(TT value, u32 address) {
 		return std::rotr((u32)value, (address & (sizeof(TT) - 1)) * 8);
 	}
@@ -380,88 +1075,43 @@ public:
 	}
 
 	void bankRegisters(cpuMode newMode, bool enterMode) {
-		u32 *currentModeBank = nullptr;
-		switch (reg.mode) {
-		case MODE_SYSTEM:
-		case MODE_USER: currentModeBank = reg.R_usr; break;
-		case MODE_FIQ: currentModeBank = reg.R_fiq; break;
-		case MODE_IRQ: currentModeBank = reg.R_irq; break;
-		case MODE_SUPERVISOR: currentModeBank = reg.R_svc; break;
-		case MODE_ABORT: currentModeBank = reg.R_abt; break;
-		case MODE_UNDEFINED: currentModeBank = reg.R_und; break;
-		}
-
-		u32 *newModeBank = nullptr;
-		switch (newMode) {
-		case MODE_SYSTEM:
-		case MODE_USER: newModeBank = reg.R_usr; break;
-		case MODE_FIQ: newModeBank = reg.R_fiq; break;
-		case MODE_IRQ: newModeBank = reg.R_irq; break;
-		case MODE_SUPERVISOR: newModeBank = reg.R_svc; break;
-		case MODE_ABORT: newModeBank = reg.R_abt; break;
-		case MODE_UNDEFINED: newModeBank = reg.R_und; break;
-		default:
+		registerBank currentBank = modeBank[reg.mode];
+		registerBank newBank = modeBank[newMode];
+		if (newBank == BANK_INVALID) {
 			printf("Invalid mode 0x%02X\n", newMode);
 			bus.log << fmt::format("Invalid mode 0x{:0>2X}\n", (int)newMode);
 			bus.hacf();
 			return;
 		}
 
-		// Save current bank
-		if (reg.mode == MODE_FIQ) {
-			reg.R_fiq[0] = reg.R[8];
-			reg.R_fiq[1] = reg.R[9];
-			reg.R_fiq[2] = reg.R[10];
-			reg.R_fiq[3] = reg.R[11];
-			reg.R_fiq[4] = reg.R[12];
-		} else { // User mode R8-R12 stores whatever was in R8-R12 so any mode can be switched to from fiq
-			reg.R_usr[0] = reg.R[8];
-			reg.R_usr[1] = reg.R[9];
-			reg.R_usr[2] = reg.R[10];
-			reg.R_usr[3] = reg.R[11];
-			reg.R_usr[4] = reg.R[12];
-		}
-		currentModeBank[5] = reg.R[13];
-		currentModeBank[6] = reg.R[14];
-
-		// Load new bank
-		if (newMode == MODE_FIQ) {
-			reg.R[8] = reg.R_fiq[0];
-			reg.R[9] = reg.R_fiq[1];
-			reg.R[10] = reg.R_fiq[2];
-			reg.R[11] = reg.R_fiq[3];
-			reg.R[12] = reg.R_fiq[4];
-		} else {
-			reg.R[8] = reg.R_usr[0];
-			reg.R[9] = reg.R_usr[1];
-			reg.R[10] = reg.R_usr[2];
-			reg.R[11] = reg.R_usr[3];
-			reg.R[12] = reg.R_usr[4];
+		// R8-R12 only need to move when entering or leaving FIQ mode
+		if ((currentBank == BANK_FIQ) != (newBank == BANK_FIQ)) {
+			memcpy(reg.R_bank[currentBank == BANK_FIQ ? BANK_FIQ : BANK_USR], &reg.R[8], 5 * sizeof(u32));
+			memcpy(&reg.R[8], reg.R_bank[newBank == BANK_FIQ ? BANK_FIQ : BANK_USR], 5 * sizeof(u32));
+		}
+		if (currentBank != newBank) {
+			reg.R_bank[currentBank][5] = reg.R[13];
+			reg.R_bank[currentBank][6] = reg.R[14];
+			reg.R[13] = reg.R_bank[newBank][5];
+			reg.R[14] = reg.R_bank[newBank][6];
 		}
-		reg.R[13] = newModeBank[5];
-		reg.R[14] = newModeBank[6];
 
 		// Save SPSR and set new CPSR
 		if (enterMode) {
-			if (newMode != MODE_SYSTEM && newMode != MODE_USER)
-				newModeBank[7] = reg.CPSR;
-			reg.CPSR = (reg.CPSR & ~0x3F) | newMode;
+			if (newBank != BANK_USR)
+				reg.R_bank[newBank][7] = getCPSR();
+			reg.controlBits = (reg.controlBits & ~0x3F) | newMode;
 		}
 	}
 
 	void leaveMode() {
-		u32 tmpPSR = reg.CPSR;
-		switch (reg.mode) {
-		case MODE_FIQ: tmpPSR = reg.R_fiq[7]; break;
-		case MODE_IRQ: tmpPSR = reg.R_irq[7]; break;
-		case MODE_SUPERVISOR: tmpPSR = reg.R_svc[7]; break;
-		case MODE_ABORT: tmpPSR = reg.R_abt[7]; break;
-		case MODE_UNDEFINED: tmpPSR = reg.R_und[7]; break;
-		}
-		bankRegisters((cpuMode)(tmpPSR & 0x1F), false);
-		reg.CPSR = tmpPSR;
+		u32 *spsr = currentSPSR();
+		u32 newPSR = spsr ? *spsr : getCPSR();
+		bankRegisters((cpuMode)(newPSR & 0x1F), false);
+		setCPSR(newPSR);
 	}
 
+
 	/* ARM instructions */
 	template <bool iBit, int operation, bool sBit> void dataProcessing(u32 opcode)  {
 		// Shift and rotate to get operands
@@ -475,8 +1125,8 @@ public:
 		bool shifterCarry = computeShift<false, iBit>(opcode, &operand2);
 
 		// Perform operation
-		bool operationCarry = reg.flagC;
-		bool operationOverflow = reg.flagV;
+		bool operationCarry = false;
+		bool operationOverflow = false;
 		operand1 = reg.R[(opcode >> 16) & 0xF];
 		u32 result = 0;
 		auto destinationReg = (opcode & (0xF << 12)) >> 12;
@@ -488,19 +1138,13 @@ public:
 			result = operand1 ^ operand2;
 			break;
 		case 0x2: // SUB
-			operationCarry = operand1 >= operand2;
 			result = operand1 - operand2;
-			operationOverflow = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
 			break;
 		case 0x3: // RSB
-			operationCarry = operand2 >= operand1;
 			result = operand2 - operand1;
-			operationOverflow = ((operand2 ^ operand1) & ((operand2 ^ result)) & 0x80000000) > 0;
 			break;
 		case 0x4: // ADD
-			operationCarry = ((u64)operand1 + (u64)operand2) >> 32;
 			result = operand1 + operand2;
-			operationOverflow = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
 			break;
 		case 0x5: // ADC
 			operationCarry = ((u64)operand1 + (u64)operand2 + reg.flagC) >> 32;
@@ -524,14 +1168,10 @@ public:
 			result = operand1 ^ operand2;
 			break;
 		case 0xA: // CMP
-			operationCarry = operand1 >= operand2;
 			result = operand1 - operand2;
-			operationOverflow = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
 			break;
 		case 0xB: // CMN
-			operationCarry = ((u64)operand1 + (u64)operand2) >> 32;
 			result = operand1 + operand2;
-			operationOverflow = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
 			break;
 		case 0xC: // ORR
 			result = operand1 | operand2;
@@ -549,18 +1189,21 @@ public:
 
 		// Compute common flags
 		if constexpr (sBit) {
-			reg.flagN = result >> 31;
-			reg.flagZ = result == 0;
-			if ((operation < 2) || (operation == 8) || (operation == 9) || (operation >= 0xC)) { // Logical operations
-				reg.flagC = shifterCarry;
+			if constexpr ((operation < 2) || (operation == 8) || (operation == 9) || (operation >= 0xC)) { // Logical operations
+				setFlagsLogical(result, shifterCarry);
+			} else if constexpr ((operation == 0x2) || (operation == 0xA)) { // SUB, CMP
+				setFlagsSub(operand1, operand2, result);
+			} else if constexpr (operation == 0x3) { // RSB
+				setFlagsSub(operand2, operand1, result);
+			} else if constexpr ((operation == 0x4) || (operation == 0xB)) { // ADD, CMN
+				setFlagsAdd(operand1, operand2, result);
 			} else {
-				reg.flagC = operationCarry;
-				reg.flagV = operationOverflow;
+				setFlags(result, operationCarry, operationOverflow);
 			}
 		}
 
 		if (shiftReg) {
-			bus.iCycle(1); // TODO: Should probably be after setting register
+			internalCycles(1); // TODO: Should probably be after setting register
 		} else {
 			fetchOpcode();
 		}
@@ -588,17 +1231,15 @@ public:
 		u32 result = multiplier * reg.R[opcode & 0xF];
 		if constexpr (accumulate) {
 			result += reg.R[(opcode >> 12) & 0xF];
-			bus.iCycle(1);
+			internalCycles(1);
 		}
 		if (destinationReg != 15)
 			reg.R[destinationReg] = result;
-		if constexpr (sBit) {
-			reg.flagN = result >> 31;
-			reg.flagZ = result == 0;
-		}
+		if constexpr (sBit)
+			setFlagsNZ(result);
 
 		int multiplierCycles = ((31 - std::max(std::countl_zero(multiplier), std::countl_one(multiplier))) / 8) + 1;
-		bus.iCycle(multiplierCycles);
+		internalCycles(multiplierCycles);
 	}
 
 	template <bool signedMul, bool accumulate, bool sBit> void multiplyLong(u32 opcode) {
@@ -618,14 +1259,14 @@ public:
 		}
 		if constexpr (accumulate) {
 			result += ((u64)reg.R[destinationRegHigh] << 32) | (u64)reg.R[destinationRegLow];
-			bus.iCycle(1);
+			internalCycles(1);
 		}
 		if constexpr (sBit) {
 			reg.flagN = result >> 63;
 			reg.flagZ = result == 0;
 		}
 
-		bus.iCycle(multiplierCycles + 1);
+		internalCycles(multiplierCycles + 1);
 
 		if (destinationRegLow != 15)
 			reg.R[destinationRegLow] = result;
@@ -641,15 +1282,15 @@ public:
 		fetchOpcode();
 
 		if constexpr (byteWord) {
-			result = bus.template read<u8, false>(address, true);
-			bus.template write<u8>(address, (u8)reg.R[sourceRegister], false);
+			result = dataRead<u8>(address, true);
+			dataWrite<u8>(address, (u8)reg.R[sourceRegister], false);
 		} else {
-			result = rotateMisaligned(bus.template read<u32, false>(address, true), address);
-			bus.template write<u32>(address, reg.R[sourceRegister], false);
+			result = rotateMisaligned(dataRead<u32>(address, true), address);
+			dataWrite<u32>(address, reg.R[sourceRegister], false);
 		}
 
 		reg.R[destinationRegister] = result;
-		bus.iCycle(1);
+		internalCycles(1);
 
 		if (destinationRegister == 15) {
 			flushPipeline();
@@ -659,59 +1300,51 @@ public:
 	template <bool targetPSR> void psrLoad(u32 opcode) {
 		u32 destinationReg = (opcode >> 12) & 0xF;
 
-		if constexpr (targetPSR) {
-			switch (reg.mode) {
-			case MODE_FIQ: reg.R[destinationReg] = reg.R_fiq[7]; break;
-			case MODE_IRQ: reg.R[destinationReg] = reg.R_irq[7]; break;
-			case MODE_SUPERVISOR: reg.R[destinationReg] = reg.R_svc[7]; break;
-			case MODE_ABORT: reg.R[destinationReg] = reg.R_abt[7]; break;
-			case MODE_UNDEFINED: reg.R[destinationReg] = reg.R_und[7]; break;
-			default: reg.R[destinationReg] = reg.CPSR; break;
-			}
-		} else {
-			reg.R[destinationReg] = reg.CPSR;
-		}
+		u32 *spsr = targetPSR ? currentSPSR() : nullptr;
+		reg.R[destinationReg] = spsr ? *spsr : getCPSR();
 
 		fetchOpcode();
 	}
 
+
 	template <bool targetPSR> void psrStoreReg(u32 opcode) {
 		u32 operand = reg.R[opcode & 0xF];
 
-		u32 *target;
+		u32 *spsr;
+		u32 current;
 		if constexpr (targetPSR) {
-			switch (reg.mode) {
-			case MODE_FIQ: target = &reg.R_fiq[7]; break;
-			case MODE_IRQ: target = &reg.R_irq[7]; break;
-			case MODE_SUPERVISOR: target = &reg.R_svc[7]; break;
-			case MODE_ABORT: target = &reg.R_abt[7]; break;
-			case MODE_UNDEFINED: target = &reg.R_und[7]; break;
-			default:
+			spsr = currentSPSR();
+			if (!spsr) {
 				fetchOpcode();
 				return;
 			}
+			current = *spsr;
 		} else {
-			target = &reg.CPSR;
+			current = getCPSR();
 		}
 
 		u32 result = 0;
 		if (opcode & (1 << 19)) {
 			result |= operand & 0xF8000000;
 		} else {
-			result |= *target & 0xF8000000;
+			result |= current & 0xF8000000;
 		}
 		if ((opcode & (1 << 16)) && reg.mode != MODE_USER) {
 			result |= operand & 0x000000FF;
 			if constexpr (!targetPSR)
 				bankRegisters((cpuMode)(operand & 0x1F), false);
 		} else {
-			result |= *target & 0x000000FF;
+			result |= current & 0x000000FF;
 		}
 
-#ifdef ARM946E_DISABLE_FIQ
-		result |= 0x00000040;
-#endif
-		*target = result | 0x00000010; // M[4] is always 1
+		if constexpr (!Policy::fiq)
+			result |= 0x00000040;
+		result |= 0x00000010; // M[4] is always 1
+		if constexpr (targetPSR) {
+			*spsr = result;
+		} else {
+			setCPSR(result);
+		}
 		fetchOpcode();
 	}
 
@@ -720,38 +1353,41 @@ public:
 		u32 shiftAmount = (opcode & (0xF << 8)) >> 7;
 		operand = shiftAmount ? ((operand >> shiftAmount) | (operand << (32 - shiftAmount))) : operand;
 
-		u32 *target;
+		u32 *spsr;
+		u32 current;
 		if constexpr (targetPSR) {
-			switch (reg.mode) {
-			case MODE_FIQ: target = &reg.R_fiq[7]; break;
-			case MODE_IRQ: target = &reg.R_irq[7]; break;
-			case MODE_SUPERVISOR: target = &reg.R_svc[7]; break;
-			case MODE_ABORT: target = &reg.R_abt[7]; break;
-			case MODE_UNDEFINED: target = &reg.R_und[7]; break;
-			default: fetchOpcode(); return;
+			spsr = currentSPSR();
+			if (!spsr) {
+				fetchOpcode();
+				return;
 			}
+			current = *spsr;
 		} else {
-			target = &reg.CPSR;
+			current = getCPSR();
 		}
 
 		u32 result = 0;
 		if (opcode & (1 << 19)) {
 			result |= operand & 0xF8000000;
 		} else {
-			result |= *target & 0xF8000000;
+			result |= current & 0xF8000000;
 		}
 		if ((opcode & (1 << 16)) && reg.mode != MODE_USER) {
 			result |= operand & 0x000000FF;
 			if constexpr (!targetPSR)
 				bankRegisters((cpuMode)(operand & 0x1F), false);
 		} else {
-			result |= *target & 0x000000FF;
+			result |= current & 0x000000FF;
 		}
 
-#ifdef ARM946E_DISABLE_FIQ
-		result |= 0x00000040;
-#endif
-		*target = result | 0x00000010; // M[4] is always 1
+		if constexpr (!Policy::fiq)
+			result |= 0x00000040;
+		result |= 0x00000010; // M[4] is always 1
+		if constexpr (targetPSR) {
+			*spsr = result;
+		} else {
+			setCPSR(result);
+		}
 		fetchOpcode();
 	}
 
@@ -875,21 +1511,21 @@ public:
 		u32 result2 = 0;
 		if constexpr (loadStore) {
 			if constexpr (shBits == 1) { // LDRH
-				result = bus.template read<u16, false>(address & ~1, false);
+				result = dataRead<u16>(address & ~1, false);
 			} else if constexpr (shBits == 2) { // LDRSB
-				result = ((i32)((u32)bus.template read<u8, false>(address, false) << 24) >> 24);
+				result = ((i32)((u32)dataRead<u8>(address, false) << 24) >> 24);
 			} else if constexpr (shBits == 3) { // LDRSH
-				result = (i32)((u32)bus.template read<u16, false>(address & ~1, false) << 16) >> 16;
+				result = (i32)((u32)dataRead<u16>(address & ~1, false) << 16) >> 16;
 			}
 		} else {
 			if constexpr (shBits == 1) { // STRH
-				bus.template write<u16>(address, (u16)reg.R[srcDestRegister], false);
+				dataWrite<u16>(address, (u16)reg.R[srcDestRegister], false);
 			} else if constexpr (shBits == 2) { // LDRD
-				result = bus.template read<u32, false>(address & ~3, false);
-				result2 = bus.template read<u32, false>((address + 4) & ~3, false);
+				result = dataRead<u32>(address & ~3, false);
+				result2 = dataRead<u32>((address + 4) & ~3, false);
 			} else if constexpr (shBits == 3) { // STRD
-				bus.template write<u32>(address, reg.R[srcDestRegister], false);
-				bus.template write<u32>(address + 4, reg.R[srcDestRegister + 1], false);
+				dataWrite<u32>(address, reg.R[srcDestRegister], false);
+				dataWrite<u32>(address + 4, reg.R[srcDestRegister + 1], false);
 			}
 
 			nextFetchType = false;
@@ -911,7 +1547,7 @@ public:
 
 		if constexpr (loadStore) {
 			reg.R[srcDestRegister] = result;
-			bus.iCycle(1);
+			internalCycles(1);
 
 			if (srcDestRegister == 15) {
 				flushPipeline(true);
@@ -951,15 +1587,15 @@ public:
 		u32 result = 0;
 		if constexpr (loadStore) { // LDR
 			if constexpr (byteWord) {
-				result = bus.template read<u8, false>(address, false);
+				result = dataRead<u8>(address, false);
 			} else {
-				result = rotateMisaligned(bus.template read<u32, false>(address, false), address);
+				result = rotateMisaligned(dataRead<u32>(address, false), address);
 			}
 		} else { // STR
 			if constexpr (byteWord) {
-				bus.template write<u8>(address, reg.R[srcDestRegister], false);
+				dataWrite<u8>(address, reg.R[srcDestRegister], false);
 			} else {
-				bus.template write<u32>(address, reg.R[srcDestRegister], false);
+				dataWrite<u32>(address, reg.R[srcDestRegister], false);
 			}
 
 			nextFetchType = false;
@@ -978,7 +1614,7 @@ public:
 		}
 		if constexpr (loadStore) {
 			reg.R[srcDestRegister] = result;
-			bus.iCycle(1);
+			internalCycles(1);
 
 			if (srcDestRegister == 15) {
 				flushPipeline(true);
@@ -995,6 +1631,19 @@ public:
 		flushPipeline();
 	}
 
+#ifdef ARM946E_MPU
+	void breakpointInstruction([[maybe_unused]] u32 opcode) { // Takes the prefetch abort
+		fetchOpcode();
+		bankRegisters(MODE_ABORT, true);
+		reg.R[14] = reg.R[15] - 8;
+		reg.irqDisable = true;
+		updatePendingMask();
+
+		reg.R[15] = (cp15.vectorOffset ? 0xFFFF0000 : 0x00000000) | 0x0C;
+		flushPipeline();
+	}
+#endif
+
 	template <bool prePostIndex, bool upDown, bool sBit, bool writeBack, bool loadStore> void blockDataTransfer(u32 opcode) {
 		const u32 baseRegister = (opcode >> 16) & 0xF;
 		const bool useAltRegisterBank = sBit && !(loadStore && (opcode & (1 << 15))) && reg.mode != MODE_USER && reg.mode != MODE_SYSTEM;
@@ -1026,9 +1675,12 @@ public:
 		bool firstReadWrite = true; // TODO: Interleave fetches with register writes
 		if constexpr (loadStore) { // LDM
 			// TODO: Find timings for empty rlist
+			u32 values[16];
+			bool block = !emptyRegList && dataReadBlock(address, values, std::popcount(opcode & 0xFFFF));
+			int blockIndex = 0;
 			for (int i = 0; i < 16; i++) {
 				if (opcode & (1 << i)) {
-					u32 value = bus.template read<u32, false>(address, !firstReadWrite);
+					u32 value = block ? values[blockIndex++] : dataRead<u32>(address, !firstReadWrite);
 					if (useAltRegisterBank && i >= (reg.mode == MODE_FIQ ? 8 : 13) && i != 15) {
 						reg.R_usr[i - 8] = value;
 					} else {
@@ -1040,7 +1692,7 @@ public:
 						firstReadWrite = false;
 				}
 			}
-			bus.iCycle(1);
+			internalCycles(1);
 
 			if constexpr (writeBack) {
 				if (opcode & (baseRegister << 1)) { // Base register is in rlist
@@ -1057,17 +1709,33 @@ public:
 				flushPipeline(true);
 			}
 		} else { // STM
-			for (int i = 0; i < 16; i++) {
-				if (opcode & (1 << i)) {
-					if (useAltRegisterBank && i >= (reg.mode == MODE_FIQ ? 8 : 13) && i != 15) {
-						bus.template write<u32>(address, reg.R_usr[i - 8], !firstReadWrite);
-					} else {
-						bus.template write<u32>(address, reg.R[i], !firstReadWrite);
+			u32 values[16];
+			int count = 0;
+			if constexpr (blockTransfers()) {
+				for (int i = 0; i < 16; i++) {
+					if (opcode & (1 << i)) {
+						if (useAltRegisterBank && i >= (reg.mode == MODE_FIQ ? 8 : 13) && i != 15) {
+							values[count++] = reg.R_usr[i - 8];
+						} else {
+							values[count++] = reg.R[i];
+						}
 					}
-					address += 4;
+				}
+			}
 
-					if (firstReadWrite)
-						firstReadWrite = false;
+			if (emptyRegList || !dataWriteBlock(address, values, count)) {
+				for (int i = 0; i < 16; i++) {
+					if (opcode & (1 << i)) {
+						if (useAltRegisterBank && i >= (reg.mode == MODE_FIQ ? 8 : 13) && i != 15) {
+							dataWrite<u32>(address, reg.R_usr[i - 8], !firstReadWrite);
+						} else {
+							dataWrite<u32>(address, reg.R[i], !firstReadWrite);
+						}
+						address += 4;
+
+						if (firstReadWrite)
+							firstReadWrite = false;
+					}
 				}
 			}
 
@@ -1090,6 +1758,9 @@ public:
 			reg.R[14] = reg.R[15] - 8;
 		reg.R[15] = address;
 		flushPipeline(true);
+
+		if constexpr (!linkOffset && !useThumb)
+			checkIdleLoop(address, ((i32)((opcode & 0x00FFFFFF) << 8)) >> 6);
 	}
 
 	template <bool loadStore> void armCoprocessorRegisterTransfer(u32 opcode) {
@@ -1105,12 +1776,26 @@ public:
 			u32 result = bus.coprocessorRead(copNum, copOpc, copSrcDestReg, copOpReg, copOpcType);
 
 			if (srcDestRegister == 15) {
-				reg.CPSR = (reg.CPSR & ~0xF0000000) | (result & 0xF0000000);
+				setCPSR((getCPSR() & ~0xF0000000) | (result & 0xF0000000));
 			} else {
 				reg.R[srcDestRegister] = result;
 			}
 		} else { // MCR
+			if constexpr (detectIdleLoops())
+				idleLoop.tracking = false;
 			bus.coprocessorWrite(copNum, copOpc, copSrcDestReg, copOpReg, copOpcType, reg.R[srcDestRegister]);
+#ifdef ARM946E_INLINE_TCM
+			if ((copNum == 15) && ((copSrcDestReg == 1) || (copSrcDestReg == 9)))
+				cp15.updateTcmRegions();
+#endif
+#ifdef ARM946E_MPU
+			if ((copNum == 15) && ((copSrcDestReg == 1) || (copSrcDestReg == 2) || (copSrcDestReg == 3) || (copSrcDestReg == 5) || (copSrcDestReg == 6)))
+				cp15.updateProtectionMap();
+#endif
+#ifdef ARM946E_CACHE
+			if ((copNum == 15) && (copSrcDestReg == 7))
+				cacheOperation(copOpReg, copOpcType, reg.R[srcDestRegister]);
+#endif
 		}
 	}
 
@@ -1123,32 +1808,45 @@ public:
 		flushPipeline();
 	}
 
-	template <bool immediateOffset, bool upDown> void preload(u32 opcode) { // Basically a NOP unless I decide to implement the cache
+	template <bool immediateOffset, bool upDown> void preload(u32 opcode) { // Basically a NOP without ARM946E_CACHE
+#ifdef ARM946E_CACHE
+		u32 offset;
+		computeShift<true, immediateOffset>(opcode, &offset);
+		u32 address = reg.R[(opcode >> 16) & 0xF] + (upDown ? offset : -offset);
+		fetchOpcode();
+
+		if (dataCacheable(address) && accessAllowed(address, cp15.PROTECTION_READ))
+			cacheLine<false>(dataCache, address);
+#else
 		fetchOpcode();
+#endif
 	}
 
 	/* THUMB Instructions */
 	template <int op, int shiftAmount> void thumbMoveShiftedReg(u16 opcode)  {
 		u32 shiftOperand = reg.R[(opcode >> 3) & 7];
+		bool carry = false;
 
 		switch (op) {
 		case 0: // LSL
 			if (shiftAmount != 0) {
 				if (shiftAmount > 31) {
-					reg.flagC = (shiftAmount == 32) ? (shiftOperand & 1) : 0;
+					carry = (shiftAmount == 32) ? (shiftOperand & 1) : 0;
 					shiftOperand = 0;
 					break;
 				}
-				reg.flagC = (bool)(shiftOperand & (1 << (31 - (shiftAmount - 1))));
+				carry = (bool)(shiftOperand & (1 << (31 - (shiftAmount - 1))));
 				shiftOperand <<= shiftAmount;
+			} else {
+				carry = reg.flagC;
 			}
 			break;
 		case 1: // LSR
 			if (shiftAmount == 0) {
-				reg.flagC = shiftOperand >> 31;
+				carry = shiftOperand >> 31;
 				shiftOperand = 0;
 			} else {
-				reg.flagC = (shiftOperand >> (shiftAmount - 1)) & 1;
+				carry = (shiftOperand >> (shiftAmount - 1)) & 1;
 				shiftOperand = shiftOperand >> shiftAmount;
 			}
 			break;
@@ -1156,20 +1854,19 @@ public:
 			if (shiftAmount == 0) {
 				if (shiftOperand & (1 << 31)) {
 					shiftOperand = 0xFFFFFFFF;
-					reg.flagC = true;
+					carry = true;
 				} else {
 					shiftOperand = 0;
-					reg.flagC = false;
+					carry = false;
 				}
 			} else {
-				reg.flagC = (shiftOperand >> (shiftAmount - 1)) & 1;
+				carry = (shiftOperand >> (shiftAmount - 1)) & 1;
 				shiftOperand = ((i32)shiftOperand) >> shiftAmount;
 			}
 			break;
 		}
 
-		reg.flagN = shiftOperand >> 31;
-		reg.flagZ = shiftOperand == 0;
+		setFlagsLogical(shiftOperand, carry);
 		reg.R[opcode & 7] = shiftOperand;
 		fetchOpcode();
 	}
@@ -1180,17 +1877,11 @@ public:
 
 		u32 result;
 		if (op) { // SUB
-			reg.flagC = operand1 >= operand2;
 			result = operand1 - operand2;
-			reg.flagV = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
-			reg.flagN = result >> 31;
-			reg.flagZ = result == 0;
+			setFlagsSub(operand1, operand2, result);
 		} else { // ADD
-			reg.flagC = ((u64)operand1 + (u64)operand2) >> 32;
 			result = operand1 + operand2;
-			reg.flagV = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
-			reg.flagN = result >> 31;
-			reg.flagZ = result == 0;
+			setFlagsAdd(operand1, operand2, result);
 		}
 
 		reg.R[opcode & 7] = result;
@@ -1205,26 +1896,19 @@ public:
 		switch (op) {
 		case 0: // MOV
 			result = operand2;
+			setFlagsNZ(result);
 			break;
 		case 1: // CMP
-			reg.flagC = operand1 >= operand2;
+		case 3: // SUB
 			result = operand1 - operand2;
-			reg.flagV = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
+			setFlagsSub(operand1, operand2, result);
 			break;
 		case 2: // ADD
-			reg.flagC = ((u64)operand1 + (u64)operand2) >> 32;
 			result = operand1 + operand2;
-			reg.flagV = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
-			break;
-		case 3: // SUB
-			reg.flagC = operand1 >= operand2;
-			result = operand1 - operand2;
-			reg.flagV = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
+			setFlagsAdd(operand1, operand2, result);
 			break;
 		}
 
-		reg.flagN = result >> 31;
-		reg.flagZ = result == 0;
 		if constexpr (op != 1)
 			reg.R[destinationReg] = result;
 		fetchOpcode();
@@ -1239,6 +1923,7 @@ public:
 		constexpr bool endWithIdle = ((op == 0x2) || (op == 0x3) || (op == 0x4) || (op == 0x7) || (op == 0xD));
 
 		u32 result;
+		bool carry = false;
 		switch (op) {
 		case 0x0: // AND
 			result = operand1 & operand2;
@@ -1249,12 +1934,13 @@ public:
 		case 0x2: // LSL
 			if (operand2 == 0) {
 				result = operand1;
+				carry = reg.flagC;
 			} else {
 				if (operand2 > 31) {
-					reg.flagC = (operand2 == 32) ? (operand1 & 1) : 0;
+					carry = (operand2 == 32) ? (operand1 & 1) : 0;
 					result = 0;
 				} else {
-					reg.flagC = (operand1 & (1 << (31 - (operand2 - 1)))) > 0;
+					carry = (operand1 & (1 << (31 - (operand2 - 1)))) > 0;
 					result = operand1 << operand2;
 				}
 			}
@@ -1263,14 +1949,15 @@ public:
 		case 0x3: // LSR
 			if (operand2 == 0) {
 				result = operand1;
+				carry = reg.flagC;
 			} else if (operand2 == 32) {
 				result = 0;
-				reg.flagC = operand1 >> 31;
+				carry = operand1 >> 31;
 			} else if (operand2 > 32) {
 				result = 0;
-				reg.flagC = false;
+				carry = false;
 			} else {
-				reg.flagC = (operand1 >> (operand2 - 1)) & 1;
+				carry = (operand1 >> (operand2 - 1)) & 1;
 				result = operand1 >> operand2;
 			}
 			fetchOpcode();
@@ -1278,40 +1965,42 @@ public:
 		case 0x4: // ASR
 			if (operand2 == 0) {
 				result = operand1;
+				carry = reg.flagC;
 			} else if (operand2 > 31) {
 				if (operand1 & (1 << 31)) {
 					result = 0xFFFFFFFF;
-					reg.flagC = true;
+					carry = true;
 				} else {
 					result = 0;
-					reg.flagC = false;
+					carry = false;
 				}
 			} else {
-				reg.flagC = (operand1 >> (operand2 - 1)) & 1;
+				carry = (operand1 >> (operand2 - 1)) & 1;
 				result = ((i32)operand1) >> operand2;
 			}
 			fetchOpcode();
 			break;
 		case 0x5: // ADC
-			result = operand1 + operand2 + reg.flagC;
-			reg.flagC = ((u64)operand1 + (u64)operand2 + reg.flagC) >> 32;
-			reg.flagV = (~(operand1 ^ operand2) & ((operand1 ^ result))) >> 31;
+			carry = reg.flagC;
+			result = operand1 + operand2 + carry;
+			setFlags(result, ((u64)operand1 + (u64)operand2 + carry) >> 32, (~(operand1 ^ operand2) & ((operand1 ^ result))) >> 31);
 			break;
 		case 0x6: // SBC
-			result = (u64)operand1 - ((u64)operand2 + !reg.flagC);
-			reg.flagC = (u64)operand1 >= ((u64)operand2 + !reg.flagC);
-			reg.flagV = ((operand1 ^ operand2) & (operand1 ^ result)) >> 31;
+			carry = reg.flagC;
+			result = (u64)operand1 - ((u64)operand2 + !carry);
+			setFlags(result, (u64)operand1 >= ((u64)operand2 + !carry), ((operand1 ^ operand2) & (operand1 ^ result)) >> 31);
 			break;
 		case 0x7: // ROR
 			if (operand2 == 0) {
 				result = operand1;
+				carry = reg.flagC;
 			} else {
 				operand2 &= 31;
 				if (operand2 == 0) {
-					reg.flagC = operand1 >> 31;
+					carry = operand1 >> 31;
 					result = operand1;
 				} else {
-					reg.flagC = (bool)(operand1 & (1 << (operand2 - 1)));
+					carry = (bool)(operand1 & (1 << (operand2 - 1)));
 					result = (operand1 >> operand2) | (operand1 << (32 - operand2));
 				}
 			}
@@ -1321,26 +2010,23 @@ public:
 			result = operand1 & operand2;
 			break;
 		case 0x9: // NEG
-			reg.flagC = 0 >= operand2;
 			result = 0 - operand2;
-			reg.flagV = (operand2 & result & 0x80000000) > 0;
+			setFlagsSub(0, operand2, result);
 			break;
 		case 0xA: // CMP
-			reg.flagC = operand1 >= operand2;
 			result = operand1 - operand2;
-			reg.flagV = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
+			setFlagsSub(operand1, operand2, result);
 			break;
 		case 0xB: // CMN
-			reg.flagC = ((u64)operand1 + (u64)operand2) >> 32;
 			result = operand1 + operand2;
-			reg.flagV = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
+			setFlagsAdd(operand1, operand2, result);
 			break;
 		case 0xC: // ORR
 			result = operand1 | operand2;
 			break;
 		case 0xD: // MUL
 			fetchOpcode();
-			bus.iCycle((31 - std::max(std::countl_zero(operand1), std::countl_one(operand1))) / 8);
+			internalCycles((31 - std::max(std::countl_zero(operand1), std::countl_one(operand1))) / 8);
 
 			result = operand1 * operand2;
 			break;
@@ -1353,13 +2039,16 @@ public:
 		}
 
 		// Compute common flags
-		reg.flagN = result >> 31;
-		reg.flagZ = result == 0;
+		if constexpr ((op == 0x2) || (op == 0x3) || (op == 0x4) || (op == 0x7)) { // Shifts
+			setFlagsLogical(result, carry);
+		} else if constexpr ((op == 0x0) || (op == 0x1) || (op == 0x8) || (op >= 0xC)) { // Logical operations and MUL
+			setFlagsNZ(result);
+		}
 
 		if constexpr (writeResult)
 			reg.R[destinationReg] = result;
 		if constexpr (endWithIdle) {
-			bus.iCycle(1);
+			internalCycles(1);
 		} else {
 			fetchOpcode();
 		}
@@ -1375,11 +2064,8 @@ public:
 			result = reg.R[operand1] + reg.R[operand2];
 			break;
 		case 1: // CMP
-			reg.flagC = reg.R[operand1] >= reg.R[operand2];
 			result = reg.R[operand1] - reg.R[operand2];
-			reg.flagV = ((reg.R[operand1] ^ reg.R[operand2]) & ((reg.R[operand1] ^ result)) & 0x80000000) > 0;
-			reg.flagN = result >> 31;
-			reg.flagZ = result == 0;
+			setFlagsSub(reg.R[operand1], reg.R[operand2], result);
 			break;
 		case 2: // MOV
 			result = reg.R[operand2];
@@ -1407,8 +2093,8 @@ public:
 		u32 address = (reg.R[15] + ((opcode & 0xFF) << 2)) & ~3;
 		fetchOpcode();
 
-		reg.R[destinationReg] = rotateMisaligned(bus.template read<u32, false>(address, false), address);
-		bus.iCycle(1);
+		reg.R[destinationReg] = rotateMisaligned(dataRead<u32>(address, false), address);
+		internalCycles(1);
 	}
 
 	template <bool loadStore, bool byteWord, int offsetReg> void thumbLoadStoreRegOffset(u16 opcode) {
@@ -1418,17 +2104,17 @@ public:
 
 		if constexpr (loadStore) {
 			if constexpr (byteWord) { // LDRB
-				reg.R[srcDestRegister] = bus.template read<u8, false>(address, false);
+				reg.R[srcDestRegister] = dataRead<u8>(address, false);
 			} else { // LDR
-				reg.R[srcDestRegister] = rotateMisaligned(bus.template read<u32, false>(address, false), address);
+				reg.R[srcDestRegister] = rotateMisaligned(dataRead<u32>(address, false), address);
 			}
 
-			bus.iCycle(1);
+			internalCycles(1);
 		} else {
 			if constexpr (byteWord) { // STRB
-				bus.template write<u8>(address, (u8)reg.R[srcDestRegister], false);
+				dataWrite<u8>(address, (u8)reg.R[srcDestRegister], false);
 			} else { // STR
-				bus.template write<u32>(address, reg.R[srcDestRegister], false);
+				dataWrite<u32>(address, reg.R[srcDestRegister], false);
 			}
 
 			nextFetchType = false;
@@ -1443,24 +2129,24 @@ public:
 		u32 result = 0;
 		switch (hsBits) {
 		case 0: // STRH
-			bus.template write<u16>(address, (u16)reg.R[srcDestRegister], false);
+			dataWrite<u16>(address, (u16)reg.R[srcDestRegister], false);
 			nextFetchType = false;
 			break;
 		case 1: // LDSB
-			result = bus.template read<u8, false>(address, false);
+			result = dataRead<u8>(address, false);
 			result = (i32)(result << 24) >> 24;
 			break;
 		case 2: // LDRH
-			result = bus.template read<u16, false>(address & ~1, false);
+			result = dataRead<u16>(address & ~1, false);
 			break;
 		case 3: // LDSH
-			result = (i32)((u32)bus.template read<u16, false>(address & ~1, false) << 16) >> 16;
+			result = (i32)((u32)dataRead<u16>(address & ~1, false) << 16) >> 16;
 			break;
 		}
 
 		if constexpr (hsBits != 0) {
 			reg.R[srcDestRegister] = result;
-			bus.iCycle(1);
+			internalCycles(1);
 		}
 	}
 
@@ -1471,16 +2157,16 @@ public:
 
 		if constexpr (loadStore) {
 			if constexpr (byteWord) { // LDRB
-				reg.R[srcDestRegister] = bus.template read<u8, false>(address, false);
+				reg.R[srcDestRegister] = dataRead<u8>(address, false);
 			} else { // LDR
-				reg.R[srcDestRegister] = rotateMisaligned(bus.template read<u32, false>(address, false), address);
+				reg.R[srcDestRegister] = rotateMisaligned(dataRead<u32>(address, false), address);
 			}
-			bus.iCycle(1);
+			internalCycles(1);
 		} else {
 			if constexpr (byteWord) { // STRB
-				bus.template write<u8>(address, (u8)reg.R[srcDestRegister], false);
+				dataWrite<u8>(address, (u8)reg.R[srcDestRegister], false);
 			} else { // STR
-				bus.template write<u32>(address, reg.R[srcDestRegister], false);
+				dataWrite<u32>(address, reg.R[srcDestRegister], false);
 			}
 
 			nextFetchType = false;
@@ -1493,11 +2179,11 @@ public:
 		fetchOpcode();
 
 		if constexpr (loadStore) { // LDRH
-			reg.R[srcDestRegister] = bus.template read<u16, false>(address & ~1, false);
+			reg.R[srcDestRegister] = dataRead<u16>(address & ~1, false);
 
-			bus.iCycle(1);
+			internalCycles(1);
 		} else { // STRH
-			bus.template write<u16>(address, (u16)reg.R[srcDestRegister], false);
+			dataWrite<u16>(address, (u16)reg.R[srcDestRegister], false);
 
 			nextFetchType = false;
 		}
@@ -1508,11 +2194,11 @@ public:
 		fetchOpcode();
 
 		if constexpr (loadStore) {
-			reg.R[destinationReg] = bus.template read<u32, false>(address, false);
+			reg.R[destinationReg] = dataRead<u32>(address, false);
 
-			bus.iCycle(1);
+			internalCycles(1);
 		} else {
-			bus.template write<u32>(address, reg.R[destinationReg], false);
+			dataWrite<u32>(address, reg.R[destinationReg], false);
 
 			nextFetchType = false;
 		}
@@ -1551,19 +2237,33 @@ public:
 			fetchOpcode(); // Writeback really should be inside the main loop but this works
 
 			if (!emptyRegList) {
-				for (int i = 0; i < 8; i++) {
-					if (opcode & (1 << i)) {
-						reg.R[i] = bus.template read<u32, false>(address, !firstReadWrite);
-						address += 4;
+				u32 values[9];
+				if (dataReadBlock(address, values, std::popcount((u32)opcode & 0xFF) + pcLr)) {
+					int blockIndex = 0;
+					for (int i = 0; i < 8; i++) {
+						if (opcode & (1 << i))
+							reg.R[i] = values[blockIndex++];
+					}
+					internalCycles(1);
+					if constexpr (pcLr) {
+						reg.R[15] = values[blockIndex];
+						flushPipeline(true);
+					}
+				} else {
+					for (int i = 0; i < 8; i++) {
+						if (opcode & (1 << i)) {
+							reg.R[i] = dataRead<u32>(address, !firstReadWrite);
+							address += 4;
 
-						if (firstReadWrite)
-							firstReadWrite = false;
+							if (firstReadWrite)
+								firstReadWrite = false;
+						}
+					}
+					internalCycles(1);
+					if constexpr (pcLr) {
+						reg.R[15] = dataRead<u32>(address, true);
+						flushPipeline(true);
 					}
-				}
-				bus.iCycle(1);
-				if constexpr (pcLr) {
-					reg.R[15] = bus.template read<u32, false>(address, true);
-					flushPipeline(true);
 				}
 			}
 		} else { // PUSH/STMDB!
@@ -1574,14 +2274,27 @@ public:
 			fetchOpcode();
 
 			if (!emptyRegList) {
-				for (int i = 0; i < 8; i++) {
-					if (opcode & (1 << i)) {
-						bus.template write<u32>(address, reg.R[i], !firstReadWrite);
-						address += 4;
+				u32 values[9];
+				int count = 0;
+				if constexpr (blockTransfers()) {
+					for (int i = 0; i < 8; i++) {
+						if (opcode & (1 << i))
+							values[count++] = reg.R[i];
+					}
+					if constexpr (pcLr)
+						values[count++] = reg.R[14];
+				}
+
+				if (!dataWriteBlock(address, values, count)) {
+					for (int i = 0; i < 8; i++) {
+						if (opcode & (1 << i)) {
+							dataWrite<u32>(address, reg.R[i], !firstReadWrite);
+							address += 4;
+						}
 					}
+					if constexpr (pcLr)
+						dataWrite<u32>(address, reg.R[14], true);
 				}
-				if constexpr (pcLr)
-					bus.template write<u32>(address, reg.R[14], true);
 			}
 			nextFetchType = false;
 		}
@@ -1602,28 +2315,42 @@ public:
 			if (emptyRegList) {
 				reg.R[baseReg] = writeBackAddress;
 			} else {
+				u32 values[8];
+				bool block = dataReadBlock(address, values, std::popcount((u32)opcode & 0xFF));
+				int blockIndex = 0;
 				for (int i = 0; i < 8; i++) {
 					if (opcode & (1 << i)) {
 						if (firstReadWrite)
 							reg.R[baseReg] = writeBackAddress;
 
-						reg.R[i] = bus.template read<u32, false>(address, !firstReadWrite);
+						reg.R[i] = block ? values[blockIndex++] : dataRead<u32>(address, !firstReadWrite);
 						address += 4;
 
 						if (firstReadWrite)
 							firstReadWrite = false;
 					}
 				}
-				bus.iCycle(1);
+				internalCycles(1);
 			}
 		} else { // STMIA!
 			if (emptyRegList) {
 				reg.R[baseReg] = writeBackAddress;
 			} else {
-				for (int i = 0; i < 8; i++) {
-					if (opcode & (1 << i)) {
-						bus.template write<u32>(address, reg.R[i], !firstReadWrite);
-						address += 4;
+				u32 values[8];
+				int count = 0;
+				if constexpr (blockTransfers()) {
+					for (int i = 0; i < 8; i++) {
+						if (opcode & (1 << i))
+							values[count++] = reg.R[i];
+					}
+				}
+
+				if (!dataWriteBlock(address, values, count)) {
+					for (int i = 0; i < 8; i++) {
+						if (opcode & (1 << i)) {
+							dataWrite<u32>(address, reg.R[i], !firstReadWrite);
+							address += 4;
+						}
 					}
 				}
 
@@ -1640,6 +2367,7 @@ public:
 		if (checkCondition(condition)) {
 			reg.R[15] = newAddress;
 			flushPipeline();
+			checkIdleLoop(newAddress, (i16)(opcode << 8) >> 7);
 		}
 	}
 
@@ -1652,6 +2380,19 @@ public:
 		flushPipeline();
 	}
 
+#ifdef ARM946E_MPU
+	void thumbBreakpoint([[maybe_unused]] u16 opcode) {
+		fetchOpcode();
+		bankRegisters(MODE_ABORT, true);
+		reg.R[14] = reg.R[15] - 2;
+		reg.irqDisable = true;
+		updatePendingMask();
+
+		reg.R[15] = (cp15.vectorOffset ? 0xFFFF0000 : 0x00000000) | 0x0C;
+		flushPipeline();
+	}
+#endif
+
 	void thumbSoftwareInterrupt(u16 opcode) {
 		fetchOpcode();
 		bankRegisters(MODE_SUPERVISOR, true);
@@ -1667,6 +2408,7 @@ public:
 
 		reg.R[15] = newAddress;
 		flushPipeline();
+		checkIdleLoop(newAddress, (i16)(opcode << 5) >> 4);
 	}
 
 	void thumbBlxSuffix(u16 opcode) {
@@ -1716,6 +2458,8 @@ public:
 	static const u32 armPsrStoreImmediateBits = 0b0011'0010'0000;
 	static const u32 armSingleDataSwapMask = 0b1111'1011'1111;
 	static const u32 armSingleDataSwapBits = 0b0001'0000'1001;
+	static const u32 armBreakpointMask = 0b1111'1111'1111;
+	static const u32 armBreakpointBits = 0b0001'0010'0111;
 	static const u32 armBranchExchangeMask = 0b1111'1111'1101;
 	static const u32 armBranchExchangeBits = 0b0001'0010'0001;
 	static const u32 armCountLeadingZerosMask = 0b1111'1111'1111;
@@ -1776,6 +2520,8 @@ public:
 	static const u16 thumbMultipleLoadStoreBits = 0b1100'0000'00;
 	static const u16 thumbConditionalBranchMask = 0b1111'0000'00;
 	static const u16 thumbConditionalBranchBits = 0b1101'0000'00;
+	static const u16 thumbBreakpointMask = 0b1111'1111'00;
+	static const u16 thumbBreakpointBits = 0b1011'1110'00;
 	static const u16 thumbUndefinedMask = 0b1111'1111'00;
 	static const u16 thumbUndefinedBits = 0b1101'1110'00;
 	static const u16 thumbSoftwareInterruptMask = 0b1111'1111'00;
@@ -1787,75 +2533,93 @@ public:
 	static const u16 thumbLongBranchLinkMask = 0b1111'0000'00;
 	static const u16 thumbLongBranchLinkBits = 0b1111'0000'00;
 
-	using lutEntry = void (ARM946E<T>::*)(u32);
-	using thumbLutEntry = void (ARM946E<T>::*)(u16);
+	using lutEntry = void (ARM946E<T, Policy>::*)(u32);
+	using thumbLutEntry = void (ARM946E<T, Policy>::*)(u16);
+
+	// Instructions that access data memory are wrapped so they can be rolled back when an access aborts
+	template <auto handler, bool blockTransfer = false>
+	constexpr static auto abortable() {
+#ifdef ARM946E_MPU
+		if constexpr (std::is_same_v<decltype(handler), lutEntry>) {
+			return &ARM946E<T, Policy>::abortCheckArm<handler, blockTransfer>;
+		} else {
+			return &ARM946E<T, Policy>::abortCheckThumb<handler, blockTransfer>;
+		}
+#else
+		return handler;
+#endif
+	}
 
 	// I wanted to make this one big LUT, but it makes my compiler and Actions run out of memory
 	template <std::size_t lutFillIndex>
 	constexpr static lutEntry decode() {
 		if constexpr ((lutFillIndex & armUndefined1Mask) == armUndefined1Bits) {
-			return &ARM946E<T>::undefined;
+			return &ARM946E<T, Policy>::undefined;
 		} else if constexpr ((lutFillIndex & armUndefined2Mask) == armUndefined2Bits) {
-			return &ARM946E<T>::undefined;
+			return &ARM946E<T, Policy>::undefined;
 		} else if constexpr ((lutFillIndex & armMultiplyMask) == armMultiplyBits) {
-			return &ARM946E<T>::multiply<(bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>;
+			return &ARM946E<T, Policy>::multiply<(bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>;
 		} else if constexpr ((lutFillIndex & armMultiplyLongMask) == armMultiplyLongBits) {
-			return &ARM946E<T>::multiplyLong<(bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>;
+			return &ARM946E<T, Policy>::multiplyLong<(bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>;
 		} else if constexpr ((lutFillIndex & armPsrLoadMask) == armPsrLoadBits) {
-			return &ARM946E<T>::psrLoad<(bool)(lutFillIndex & 0b0000'0100'0000)>;
+			return &ARM946E<T, Policy>::psrLoad<(bool)(lutFillIndex & 0b0000'0100'0000)>;
 		} else if constexpr ((lutFillIndex & armPsrStoreRegMask) == armPsrStoreRegBits) {
-			return &ARM946E<T>::psrStoreReg<(bool)(lutFillIndex & 0b0000'0100'0000)>;
+			return &ARM946E<T, Policy>::psrStoreReg<(bool)(lutFillIndex & 0b0000'0100'0000)>;
 		} else if constexpr ((lutFillIndex & armPsrStoreImmediateMask) == armPsrStoreImmediateBits) {
-			return &ARM946E<T>::psrStoreImmediate<(bool)(lutFillIndex & 0b0000'0100'0000)>;
+			return &ARM946E<T, Policy>::psrStoreImmediate<(bool)(lutFillIndex & 0b0000'0100'0000)>;
 		} else if constexpr ((lutFillIndex & armSingleDataSwapMask) == armSingleDataSwapBits) {
-			return &ARM946E<T>::singleDataSwap<(bool)(lutFillIndex & 0b0000'0100'0000)>;
+			return abortable<&ARM946E<T, Policy>::singleDataSwap<(bool)(lutFillIndex & 0b0000'0100'0000)>>();
+#ifdef ARM946E_MPU
+		} else if constexpr ((lutFillIndex & armBreakpointMask) == armBreakpointBits) { // Only needed for prefetch aborts
+			return &ARM946E<T, Policy>::breakpointInstruction;
+#endif
 		} else if constexpr ((lutFillIndex & armBranchExchangeMask) == armBranchExchangeBits) {
-			return &ARM946E<T>::branchExchange<(bool)(lutFillIndex & 0b0000'0100'0010)>;
+			return &ARM946E<T, Policy>::branchExchange<(bool)(lutFillIndex & 0b0000'0100'0010)>;
 		} else if constexpr ((lutFillIndex & armCountLeadingZerosMask) == armCountLeadingZerosBits) {
-			return &ARM946E<T>::countLeadingZeros;
+			return &ARM946E<T, Policy>::countLeadingZeros;
 		} else if constexpr ((lutFillIndex & armDspAddSubtractMask) == armDspAddSubtractBits) {
-			return &ARM946E<T>::dspAddSubtract<((lutFillIndex & 0b0000'0110'0000) >> 5)>;
+			return &ARM946E<T, Policy>::dspAddSubtract<((lutFillIndex & 0b0000'0110'0000) >> 5)>;
 		} else if constexpr ((lutFillIndex & armDspMultiplyMask) == armDspMultiplyBits) {
-			return &ARM946E<T>::dspMultiply<((lutFillIndex & 0b0000'0110'0000) >> 5), (bool)(lutFillIndex & 0b0000'0000'0100), (bool)(lutFillIndex & 0b0000'0000'0010)>;
+			return &ARM946E<T, Policy>::dspMultiply<((lutFillIndex & 0b0000'0110'0000) >> 5), (bool)(lutFillIndex & 0b0000'0000'0100), (bool)(lutFillIndex & 0b0000'0000'0010)>;
 		} else if constexpr ((lutFillIndex & armHalfwordDataTransferMask) == armHalfwordDataTransferBits) {
-			return &ARM946E<T>::halfwordDataTransfer<(bool)(lutFillIndex & 0b0001'0000'0000), (bool)(lutFillIndex & 0b0000'1000'0000), (bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000), ((lutFillIndex & 0b0000'0000'0110) >> 1)>;
+			return abortable<&ARM946E<T, Policy>::halfwordDataTransfer<(bool)(lutFillIndex & 0b0001'0000'0000), (bool)(lutFillIndex & 0b0000'1000'0000), (bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000), ((lutFillIndex & 0b0000'0000'0110) >> 1)>>();
 		} else if constexpr ((lutFillIndex & armDataProcessingMask) == armDataProcessingBits) {
-			return &ARM946E<T>::dataProcessing<(bool)(lutFillIndex & 0b0010'0000'0000), ((lutFillIndex & 0b0001'1110'0000) >> 5), (bool)(lutFillIndex & 0b0000'0001'0000)>;
+			return &ARM946E<T, Policy>::dataProcessing<(bool)(lutFillIndex & 0b0010'0000'0000), ((lutFillIndex & 0b0001'1110'0000) >> 5), (bool)(lutFillIndex & 0b0000'0001'0000)>;
 		} else if constexpr ((lutFillIndex & armSingleDataTransferMask) == armSingleDataTransferBits) {
-			return &ARM946E<T>::singleDataTransfer<(bool)(lutFillIndex & 0b0010'0000'0000), (bool)(lutFillIndex & 0b0001'0000'0000), (bool)(lutFillIndex & 0b0000'1000'0000), (bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>;
+			return abortable<&ARM946E<T, Policy>::singleDataTransfer<(bool)(lutFillIndex & 0b0010'0000'0000), (bool)(lutFillIndex & 0b0001'0000'0000), (bool)(lutFillIndex & 0b0000'1000'0000), (bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>>();
 		} else if constexpr ((lutFillIndex & armBlockDataTransferMask) == armBlockDataTransferBits) {
-			return &ARM946E<T>::blockDataTransfer<(bool)(lutFillIndex & 0b0001'0000'0000), (bool)(lutFillIndex & 0b0000'1000'0000), (bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>;
+			return abortable<&ARM946E<T, Policy>::blockDataTransfer<(bool)(lutFillIndex & 0b0001'0000'0000), (bool)(lutFillIndex & 0b0000'1000'0000), (bool)(lutFillIndex & 0b0000'0100'0000), (bool)(lutFillIndex & 0b0000'0010'0000), (bool)(lutFillIndex & 0b0000'0001'0000)>, true>();
 		} else if constexpr ((lutFillIndex & armBranchMask) == armBranchBits) {
-			return &ARM946E<T>::branch<false, (bool)(lutFillIndex & 0b0001'0000'0000)>;
+			return &ARM946E<T, Policy>::branch<false, (bool)(lutFillIndex & 0b0001'0000'0000)>;
 		} else if constexpr ((lutFillIndex & armCoprocessorDoubleTransferMask) == armCoprocessorDoubleTransferBits) {
-			return &ARM946E<T>::undefined;
+			return &ARM946E<T, Policy>::undefined;
 		} else if constexpr ((lutFillIndex & armCoprocessorDataTransferMask) == armCoprocessorDataTransferBits) {
-			return &ARM946E<T>::undefined;
+			return &ARM946E<T, Policy>::undefined;
 		} else if constexpr ((lutFillIndex & armCoprocessorDataOperationMask) == armCoprocessorDataOperationBits) {
-			return &ARM946E<T>::undefined;
+			return &ARM946E<T, Policy>::undefined;
 		} else if constexpr ((lutFillIndex & armCoprocessorRegisterTransferMask) == armCoprocessorRegisterTransferBits) {
-			return &ARM946E<T>::armCoprocessorRegisterTransfer<(bool)(lutFillIndex & 0b0000'0001'0000)>;
+			return &ARM946E<T, Policy>::armCoprocessorRegisterTransfer<(bool)(lutFillIndex & 0b0000'0001'0000)>;
 		} else if constexpr ((lutFillIndex & armSoftwareInterruptMask) == armSoftwareInterruptBits) {
-			return &ARM946E<T>::softwareInterrupt;
+			return &ARM946E<T, Policy>::softwareInterrupt;
 		}
 
-		return &ARM946E<T>::unknownOpcodeArm;
+		return &ARM946E<T, Policy>::unknownOpcodeArm;
 	}
 	template <std::size_t lutFillIndex>
 	constexpr static lutEntry decode2() {
 		if constexpr ((lutFillIndex & armBranchMask) == armBranchBits) {
-			return &ARM946E<T>::branch<true, (bool)(lutFillIndex & 0b0001'0000'0000)>;
+			return &ARM946E<T, Policy>::branch<true, (bool)(lutFillIndex & 0b0001'0000'0000)>;
 		} else if constexpr ((lutFillIndex & armCoprocessorDataTransferMask) == armCoprocessorDataTransferBits) {
-			return &ARM946E<T>::undefined;
+			return &ARM946E<T, Policy>::undefined;
 		} else if constexpr ((lutFillIndex & armCoprocessorDataOperationMask) == armCoprocessorDataOperationBits) {
-			return &ARM946E<T>::undefined;
+			return &ARM946E<T, Policy>::undefined;
 		} else if constexpr ((lutFillIndex & armCoprocessorRegisterTransferMask) == armCoprocessorRegisterTransferBits) {
-			return &ARM946E<T>::armCoprocessorRegisterTransfer<(bool)(lutFillIndex & 0b0000'0001'0000)>;
+			return &ARM946E<T, Policy>::armCoprocessorRegisterTransfer<(bool)(lutFillIndex & 0b0000'0001'0000)>;
 		} else if constexpr ((lutFillIndex & armPreloadMask) == armPreloadBits) {
-			return &ARM946E<T>::preload<(bool)(lutFillIndex & 0b0010'0000'0000), (bool)(lutFillIndex & 0b0000'1000'0000)>;
+			return &ARM946E<T, Policy>::preload<(bool)(lutFillIndex & 0b0010'0000'0000), (bool)(lutFillIndex & 0b0000'1000'0000)>;
 		}
 
-		return &ARM946E<T>::unknownOpcodeArm;
+		return &ARM946E<T, Policy>::unknownOpcodeArm;
 	}
 	template <std::size_t... lutFillIndex>
 	constexpr static std::array<lutEntry, 4096> generateTable(std::index_sequence<lutFillIndex...>) {
@@ -1875,50 +2639,54 @@ public:
 	template <std::size_t lutFillIndex>
 	constexpr static thumbLutEntry decodeThumb() {
 		if constexpr ((lutFillIndex & thumbAddSubtractMask) == thumbAddSubtractBits) {
-			return &ARM946E<T>::thumbAddSubtract<(bool)(lutFillIndex & 0b0000'0100'00), (bool)(lutFillIndex & 0b0000'0010'00), (lutFillIndex & 0b0000'0001'11)>;
+			return &ARM946E<T, Policy>::thumbAddSubtract<(bool)(lutFillIndex & 0b0000'0100'00), (bool)(lutFillIndex & 0b0000'0010'00), (lutFillIndex & 0b0000'0001'11)>;
 		} else if constexpr ((lutFillIndex & thumbMoveShiftedRegMask) == thumbMoveShiftedRegBits) {
-			return &ARM946E<T>::thumbMoveShiftedReg<((lutFillIndex & 0b0001'1000'00) >> 5), (lutFillIndex & 0b0000'0111'11)>;
+			return &ARM946E<T, Policy>::thumbMoveShiftedReg<((lutFillIndex & 0b0001'1000'00) >> 5), (lutFillIndex & 0b0000'0111'11)>;
 		} else if constexpr ((lutFillIndex & thumbAluImmediateMask) == thumbAluImmediateBits) {
-			return &ARM946E<T>::thumbAluImmediate<((lutFillIndex & 0b0001'1000'00) >> 5), ((lutFillIndex & 0b0000'0111'00) >> 2)>;
+			return &ARM946E<T, Policy>::thumbAluImmediate<((lutFillIndex & 0b0001'1000'00) >> 5), ((lutFillIndex & 0b0000'0111'00) >> 2)>;
 		} else if constexpr ((lutFillIndex & thumbAluRegMask) == thumbAluRegBits) {
-			return &ARM946E<T>::thumbAluReg<(lutFillIndex & 0b0000'0011'11)>;
+			return &ARM946E<T, Policy>::thumbAluReg<(lutFillIndex & 0b0000'0011'11)>;
 		} else if constexpr ((lutFillIndex & thumbHighRegOperationMask) == thumbHighRegOperationBits) {
-			return &ARM946E<T>::thumbHighRegOperation<((lutFillIndex & 0b0000'0011'00) >> 2), (bool)(lutFillIndex & 0b0000'0000'10), (bool)(lutFillIndex & 0b0000'0000'01)>;
+			return &ARM946E<T, Policy>::thumbHighRegOperation<((lutFillIndex & 0b0000'0011'00) >> 2), (bool)(lutFillIndex & 0b0000'0000'10), (bool)(lutFillIndex & 0b0000'0000'01)>;
 		} else if constexpr ((lutFillIndex & thumbPcRelativeLoadMask) == thumbPcRelativeLoadBits) {
-			return &ARM946E<T>::thumbPcRelativeLoad<((lutFillIndex & 0b0000'0111'00) >> 2)>;
+			return abortable<&ARM946E<T, Policy>::thumbPcRelativeLoad<((lutFillIndex & 0b0000'0111'00) >> 2)>>();
 		} else if constexpr ((lutFillIndex & thumbLoadStoreRegOffsetMask) == thumbLoadStoreRegOffsetBits) {
-			return &ARM946E<T>::thumbLoadStoreRegOffset<(bool)(lutFillIndex & 0b0000'1000'00), (bool)(lutFillIndex & 0b0000'0100'00), (lutFillIndex & 0b0000'0001'11)>;
+			return abortable<&ARM946E<T, Policy>::thumbLoadStoreRegOffset<(bool)(lutFillIndex & 0b0000'1000'00), (bool)(lutFillIndex & 0b0000'0100'00), (lutFillIndex & 0b0000'0001'11)>>();
 		} else if constexpr ((lutFillIndex & thumbLoadStoreSextMask) == thumbLoadStoreSextBits) {
-			return &ARM946E<T>::thumbLoadStoreSext<((lutFillIndex & 0b0000'1100'00) >> 4), (lutFillIndex & 0b0000'0001'11)>;
+			return abortable<&ARM946E<T, Policy>::thumbLoadStoreSext<((lutFillIndex & 0b0000'1100'00) >> 4), (lutFillIndex & 0b0000'0001'11)>>();
 		} else if constexpr ((lutFillIndex & thumbLoadStoreImmediateOffsetMask) == thumbLoadStoreImmediateOffsetBits) {
-			return &ARM946E<T>::thumbLoadStoreImmediateOffset<(bool)(lutFillIndex & 0b0001'0000'00), (bool)(lutFillIndex & 0b0000'1000'00), (lutFillIndex & 0b0000'0111'11)>;
+			return abortable<&ARM946E<T, Policy>::thumbLoadStoreImmediateOffset<(bool)(lutFillIndex & 0b0001'0000'00), (bool)(lutFillIndex & 0b0000'1000'00), (lutFillIndex & 0b0000'0111'11)>>();
 		} else if constexpr ((lutFillIndex & thumbLoadStoreHalfwordMask) == thumbLoadStoreHalfwordBits) {
-			return &ARM946E<T>::thumbLoadStoreHalfword<(bool)(lutFillIndex & 0b0000'1000'00), (lutFillIndex & 0b0000'0111'11)>;
+			return abortable<&ARM946E<T, Policy>::thumbLoadStoreHalfword<(bool)(lutFillIndex & 0b0000'1000'00), (lutFillIndex & 0b0000'0111'11)>>();
 		} else if constexpr ((lutFillIndex & thumbSpRelativeLoadStoreMask) == thumbSpRelativeLoadStoreBits) {
-			return &ARM946E<T>::thumbSpRelativeLoadStore<(bool)(lutFillIndex & 0b0000'1000'00), ((lutFillIndex & 0b0000'0111'00) >> 2)>;
+			return abortable<&ARM946E<T, Policy>::thumbSpRelativeLoadStore<(bool)(lutFillIndex & 0b0000'1000'00), ((lutFillIndex & 0b0000'0111'00) >> 2)>>();
 		} else if constexpr ((lutFillIndex & thumbLoadAddressMask) == thumbLoadAddressBits) {
-			return &ARM946E<T>::thumbLoadAddress<(bool)(lutFillIndex & 0b0000'1000'00), ((lutFillIndex & 0b0000'0111'00) >> 2)>;
+			return &ARM946E<T, Policy>::thumbLoadAddress<(bool)(lutFillIndex & 0b0000'1000'00), ((lutFillIndex & 0b0000'0111'00) >> 2)>;
 		} else if constexpr ((lutFillIndex & thumbSpAddOffsetMask) == thumbSpAddOffsetBits) {
-			return &ARM946E<T>::thumbSpAddOffset<(bool)(lutFillIndex & 0b0000'0000'10)>;
+			return &ARM946E<T, Policy>::thumbSpAddOffset<(bool)(lutFillIndex & 0b0000'0000'10)>;
 		} else if constexpr ((lutFillIndex & thumbPushPopRegistersMask) == thumbPushPopRegistersBits) {
-			return &ARM946E<T>::thumbPushPopRegisters<(bool)(lutFillIndex & 0b0000'1000'00), (bool)(lutFillIndex & 0b0000'0001'00)>;
+			return abortable<&ARM946E<T, Policy>::thumbPushPopRegisters<(bool)(lutFillIndex & 0b0000'1000'00), (bool)(lutFillIndex & 0b0000'0001'00)>, true>();
 		} else if constexpr ((lutFillIndex & thumbMultipleLoadStoreMask) == thumbMultipleLoadStoreBits) {
-			return &ARM946E<T>::thumbMultipleLoadStore<(bool)(lutFillIndex & 0b0000'1000'00), ((lutFillIndex & 0b0000'0111'00) >> 2)>;
+			return abortable<&ARM946E<T, Policy>::thumbMultipleLoadStore<(bool)(lutFillIndex & 0b0000'1000'00), ((lutFillIndex & 0b0000'0111'00) >> 2)>, true>();
+#ifdef ARM946E_MPU
+		} else if constexpr ((lutFillIndex & thumbBreakpointMask) == thumbBreakpointBits) {
+			return &ARM946E<T, Policy>::thumbBreakpoint;
+#endif
 		} else if constexpr ((lutFillIndex & thumbUndefinedMask) == thumbUndefinedBits) {
-			return &ARM946E<T>::thumbUndefined;
+			return &ARM946E<T, Policy>::thumbUndefined;
 		} else if constexpr ((lutFillIndex & thumbSoftwareInterruptMask) == thumbSoftwareInterruptBits) {
-			return &ARM946E<T>::thumbSoftwareInterrupt;
+			return &ARM946E<T, Policy>::thumbSoftwareInterrupt;
 		} else if constexpr ((lutFillIndex & thumbConditionalBranchMask) == thumbConditionalBranchBits) {
-			return &ARM946E<T>::thumbConditionalBranch<((lutFillIndex & 0b0000'1111'00) >> 2)>;
+			return &ARM946E<T, Policy>::thumbConditionalBranch<((lutFillIndex & 0b0000'1111'00) >> 2)>;
 		} else if constexpr ((lutFillIndex & thumbUnconditionalBranchMask) == thumbUnconditionalBranchBits) {
-			return &ARM946E<T>::thumbUnconditionalBranch;
+			return &ARM946E<T, Policy>::thumbUnconditionalBranch;
 		} else if constexpr ((lutFillIndex & thumbBlxSuffixMask) == thumbBlxSuffixBits) {
-			return &ARM946E<T>::thumbBlxSuffix;
+			return &ARM946E<T, Policy>::thumbBlxSuffix;
 		} else if constexpr ((lutFillIndex & thumbLongBranchLinkMask) == thumbLongBranchLinkBits) {
-			return &ARM946E<T>::thumbLongBranchLink<(bool)(lutFillIndex & 0b0000'1000'00)>;
+			return &ARM946E<T, Policy>::thumbLongBranchLink<(bool)(lutFillIndex & 0b0000'1000'00)>;
 		}
 
-		return &ARM946E<T>::unknownOpcodeThumb;
+		return &ARM946E<T, Policy>::unknownOpcodeThumb;
 	}
 	template <std::size_t... lutFillIndex>
 	constexpr static std::array<thumbLutEntry, 1024> generateTableThumb(std::index_sequence<lutFillIndex...>) {
@@ -1927,4 +2695,408 @@ public:
 	constexpr static const std::array<thumbLutEntry, 1024> thumbLUT = {
 		generateTableThumb(std::make_index_sequence<1024>())
 	};
+
+#ifdef ARM946E_MPU
+	/* Memory Protection */
+	// With ARM946E_MPU every access is checked against cp15.protectionMap. Fetches from pages that can't be executed
+	// read as BKPT, which takes the prefetch abort once it reaches execute just like an aborted fetch. A data access
+	// that fails is dropped, and once the handler returns the registers are put back the way they were before the
+	// instruction and the data abort is taken. Single transfers never write back before their access, so they only
+	// save the registers when it fails. Block transfers can write back before a later transfer aborts, so they save
+	// them before starting. LDM/POP also check their whole range before loading anything.
+	struct {
+		bool pending;
+		bool saved;
+		u32 CPSR;
+		u32 R[16];
+	} dataAbort;
+
+	bool accessAllowed(u32 address, u8 flag) {
+		return cp15.protectionMap[address >> 12] & (flag << ((reg.mode == MODE_USER) ? cp15.PROTECTION_USER_SHIFT : 0));
+	}
+
+	void saveAbortState() {
+		dataAbort.saved = true;
+		dataAbort.CPSR = getCPSR();
+		memcpy(dataAbort.R, reg.R, sizeof(dataAbort.R));
+	}
+
+	void abortAccess() {
+		if (!dataAbort.saved)
+			saveAbortState();
+		dataAbort.pending = true;
+	}
+
+	// Before the handler's fetch, so r15 is moved on to where an abort taken after it would find it
+	void saveBlockTransferState() {
+		saveAbortState();
+		dataAbort.R[15] += reg.thumbMode ? 2 : 4;
+	}
+
+	template <lutEntry handler, bool blockTransfer> void abortCheckArm(u32 opcode) {
+		if constexpr (blockTransfer)
+			saveBlockTransferState();
+		(this->*handler)(opcode);
+		dataAbort.saved = false;
+		if (dataAbort.pending) [[unlikely]]
+			serviceDataAbort();
+	}
+
+	template <thumbLutEntry handler, bool blockTransfer> void abortCheckThumb(u16 opcode) {
+		if constexpr (blockTransfer)
+			saveBlockTransferState();
+		(this->*handler)(opcode);
+		dataAbort.saved = false;
+		if (dataAbort.pending) [[unlikely]]
+			serviceDataAbort();
+	}
+
+	void serviceDataAbort() {
+		dataAbort.pending = false;
+		cpuMode oldMode = (cpuMode)(dataAbort.CPSR & 0x1F);
+		if (reg.mode != oldMode) // LDM with ^ and r15
+			bankRegisters(oldMode, false);
+		setCPSR(dataAbort.CPSR);
+		memcpy(reg.R, dataAbort.R, sizeof(reg.R));
+
+		u32 returnAddress = reg.R[15] + (reg.thumbMode ? 2 : -4); // Aborted instruction + 8
+		bankRegisters(MODE_ABORT, true);
+		reg.R[14] = returnAddress;
+		reg.irqDisable = true;
+		updatePendingMask();
+
+		reg.R[15] = (cp15.vectorOffset ? 0xFFFF0000 : 0x00000000) | 0x10;
+		flushPipeline();
+	}
+#endif
+
+#ifdef ARM946E_TRACE_ACCESSES
+	/* Access Tracing */
+	// With ARM946E_TRACE_ACCESSES every data access made by an instruction is pushed to accessTrace while it is set.
+	// Something should drain the ring (e.g. an AccessTraceWriter). The core waits for an attached consumer when the ring
+	// is full, and drops records (see AccessTraceRing::dropped()) when none is attached.
+	// Cycles come from the core with ARM946E_LOCAL_CYCLES, otherwise from the bus's cycleCount() if it has one.
+	AccessTraceRing *accessTrace = nullptr;
+
+	void traceAccess(u32 address, u32 value, u8 size, bool write) {
+		if (!accessTrace)
+			return;
+
+		AccessRecord record;
+#ifdef ARM946E_LOCAL_CYCLES
+		record.cycle = cycles;
+#else
+		if constexpr (requires (T& b) { { b.cycleCount() } -> std::convertible_to<u64>; }) {
+			flushPendingCycles();
+			record.cycle = bus.cycleCount();
+		} else {
+			record.cycle = 0;
+		}
+#endif
+		record.address = address;
+		record.value = value;
+		record.pc = reg.R[15] - (reg.thumbMode ? 6 : 12); // Handlers have fetched the next opcode by the time they access memory
+		record.size = size;
+		record.write = write;
+		record.reserved = 0;
+		accessTrace->push(record);
+	}
+#endif
+
+	/* Code Pages */
+	// One bit per 4KB page code was fetched from, in a two-level table of lazily allocated bitmaps. Pages are marked by
+	// fetches that refill the pipeline or run into a new page, and only if something acts on their writes: the bus's
+	// optional codeModified() hook, or ARM946E_SMC_CHECK. codeWritten() unmarks a written page and passes its address to
+	// codeModified(), so anything that caches guest code can follow. The bus calls it for writes the core doesn't see
+	// (DMA, file loads). With ARM946E_SMC_CHECK every data write made by the core checks the bitmap too.
+	static constexpr std::size_t CODE_PAGE_BITS = 12;
+	static constexpr std::size_t CODE_PAGE_MASK = (1 << CODE_PAGE_BITS) - 1;
+	static constexpr std::size_t CODE_BMP_BITS = 12;
+	static constexpr std::size_t CODE_BMP_SIZE = 1 << CODE_BMP_BITS;
+	static constexpr std::size_t CODE_TABLE_SIZE = 1 << (32 - CODE_PAGE_BITS - CODE_BMP_BITS);
+	std::vector<std::unique_ptr<std::bitset<CODE_BMP_SIZE>>> codePagesTable;
+
+	static constexpr bool codeModifiedHook() {
+		return requires (T& b, u32 address) { b.codeModified(address); };
+	}
+
+	static constexpr bool trackCodePages() {
+#ifdef ARM946E_SMC_CHECK
+		return true;
+#else
+		return codeModifiedHook();
+#endif
+	}
+
+	bool isCodePage(u32 address) {
+		const auto& bitmap = codePagesTable[address >> (CODE_PAGE_BITS + CODE_BMP_BITS)];
+		return bitmap && bitmap->test((address >> CODE_PAGE_BITS) & (CODE_BMP_SIZE - 1));
+	}
+
+	void markCodePage(u32 address) {
+		auto& bitmap = codePagesTable[address >> (CODE_PAGE_BITS + CODE_BMP_BITS)];
+		if (!bitmap)
+			bitmap = std::make_unique<std::bitset<CODE_BMP_SIZE>>();
+		bitmap->set((address >> CODE_PAGE_BITS) & (CODE_BMP_SIZE - 1));
+	}
+
+	// size is in bytes, the range may span several pages. The pages being executed and fetched from stay marked, since
+	// sequential fetches wouldn't mark them again.
+	void codeWritten(u32 address, u32 size = 1) {
+		u32 last = address + size - 1;
+		u32 executingPage = (reg.R[15] - (reg.thumbMode ? 4 : 8)) >> CODE_PAGE_BITS;
+		u32 fetchPage = reg.R[15] >> CODE_PAGE_BITS;
+		for (u32 page = address >> CODE_PAGE_BITS; page <= (last >> CODE_PAGE_BITS); page++) {
+			auto& bitmap = codePagesTable[page >> CODE_BMP_BITS];
+			if (!bitmap || !bitmap->test(page & (CODE_BMP_SIZE - 1))) [[likely]]
+				continue;
+
+			if ((page != executingPage) && (page != fetchPage)) {
+				bitmap->reset(page & (CODE_BMP_SIZE - 1));
+				if (bitmap->none())
+					bitmap.reset();
+			}
+			if constexpr (codeModifiedHook())
+				bus.codeModified(page << CODE_PAGE_BITS);
+		}
+	}
+
+
+	/* Idle Loop Detection */
+	// Enabled when the bus provides bool isVolatile(u32 address) and void idleLoop(u32 address).
+	// A short backward branch taken twice with identical registers, with no stores and only volatile reads in between,
+	// can only leave the loop once something outside the core changes, so the bus gets a chance to skip ahead to its next event.
+	// The hook may call requestExit() to break out of runUntil()/runFor().
+	static constexpr bool detectIdleLoops() {
+		return requires (T& b, u32 address) {
+			{ b.isVolatile(address) } -> std::convertible_to<bool>;
+			b.idleLoop(address);
+		};
+	}
+
+	static constexpr i32 IDLE_LOOP_MAX_LENGTH = 32; // In bytes, measured back from the branch's PC
+	struct {
+		bool tracking;
+		u32 target;
+		u32 CPSR;
+		u32 R[15];
+	} idleLoop;
+
+	void checkIdleLoop(u32 target, i32 offset) {
+		if constexpr (detectIdleLoops()) {
+			if ((offset >= 0) || (offset < -IDLE_LOOP_MAX_LENGTH))
+				return;
+
+			if (idleLoop.tracking && (idleLoop.target == target) && (idleLoop.CPSR == getCPSR()) && !memcmp(idleLoop.R, reg.R, sizeof(idleLoop.R))) {
+				bus.idleLoop(target);
+				return;
+			}
+
+			idleLoop.tracking = true;
+			idleLoop.target = target;
+			idleLoop.CPSR = getCPSR();
+			memcpy(idleLoop.R, reg.R, sizeof(idleLoop.R));
+		}
+	}
+
+	/* Cycle Counting */
+	// Time spent in internal cycles, and every access timed by the core itself, is charged here
+	template <typename TT> static u32 timingCycles(const AccessTiming& timing, bool sequential) {
+		if constexpr (sizeof(TT) == 4) {
+			return sequential ? timing.sequential32 : timing.nonsequential32;
+		} else {
+			return sequential ? timing.sequential16 : timing.nonsequential16;
+		}
+	}
+
+	void internalCycles(int count) {
+#ifdef ARM946E_LOCAL_CYCLES
+		cycles += count;
+#else
+		bus.iCycle(count);
+#endif
+	}
+
+	// An access the core served without the bus. cost comes from the fetch region or fastmem page, and is
+	// replaced by the region timing table when the core keeps its own time.
+	template <typename TT> void directAccessCycles(u32 address, bool sequential, u32 cost) {
+#ifdef ARM946E_LOCAL_CYCLES
+		accessCycles<TT>(address, sequential);
+#else
+		pendingCycles += cost;
+#endif
+	}
+
+	// Accesses that go through the bus are only timed here when the core keeps its own time
+	template <typename TT> void accessCycles([[maybe_unused]] u32 address, [[maybe_unused]] bool sequential) {
+#ifdef ARM946E_LOCAL_CYCLES
+		cycles += timingCycles<TT>(regionTiming[address >> 24], sequential);
+#endif
+	}
+
+	// TCM and cache hits run at core speed, one cycle whatever the width
+	void coreSpeedCycles() {
+#ifdef ARM946E_LOCAL_CYCLES
+		cycles += 1;
+#else
+		pendingCycles += 1;
+#endif
+	}
+
+	void blockCycles([[maybe_unused]] u32 address, [[maybe_unused]] int count) {
+#ifdef ARM946E_LOCAL_CYCLES
+		const AccessTiming& timing = regionTiming[address >> 24];
+		cycles += timing.nonsequential32 + ((count - 1) * timing.sequential32);
+#endif
+	}
+
+	static constexpr bool deadlineHook() {
+		return requires (T& b) { b.deadlineReached(); };
+	}
+
+	void checkDeadline() {
+#ifdef ARM946E_LOCAL_CYCLES
+		if constexpr (deadlineHook()) {
+			if (cycles >= cycleDeadline) [[unlikely]]
+				bus.deadlineReached();
+		}
+#endif
+	}
+
+#ifdef ARM946E_LOCAL_CYCLES
+	// With ARM946E_LOCAL_CYCLES the core keeps time itself instead of calling bus.iCycle(), and bus.read()/write() must not
+	// count cycles. Accesses are charged from regionTiming[], indexed by address bits 24-31 and filled in by the bus.
+	// bus.deadlineReached() is called at the first instruction boundary where cycles >= cycleDeadline,
+	// and is expected to move the deadline with setDeadline(). A bus without the hook has no deadline.
+	u64 cycles = 0;
+	u64 cycleDeadline = ~(u64)0;
+	std::array<AccessTiming, 256> regionTiming = {};
+
+	void setRegionTiming(u32 firstRegion, u32 lastRegion, AccessTiming timing) {
+		for (u32 region = firstRegion; region <= lastRegion; region++)
+			regionTiming[region] = timing;
+	}
+
+	void setDeadline(u64 deadline) {
+		cycleDeadline = deadline;
+	}
+#endif
+
+#ifdef ARM946E_INLINE_TCM
+	/* Tightly Coupled Memory */
+	// With ARM946E_INLINE_TCM, code fetches from ITCM and data accesses to ITCM or DTCM never reach the bus. The windows
+	// come from cp15.updateTcmRegions(), so a bus that changes cp15 registers other than through MCR has to call it too.
+	u8 *tcmPointer(u32 address, bool write) {
+		if ((address < cp15.itcmEnd) && (write ? cp15.itcmWritable : cp15.itcmReadable))
+			return cp15.itcm + (address & 0x7FFF);
+		if (((address - cp15.dtcmStart) < (cp15.dtcmEnd - cp15.dtcmStart)) && (write ? cp15.dtcmWritable : cp15.dtcmReadable))
+			return cp15.dtcm + ((address - cp15.dtcmStart) & 0x3FFF);
+		return nullptr;
+	}
+#endif
+
+#ifdef ARM946E_CACHE
+#ifndef ARM946E_MPU
+#error "ARM946E_CACHE needs ARM946E_MPU for the cacheable bits of the protection regions"
+#endif
+	/* Caches */
+	// With ARM946E_CACHE, accesses to cacheable regions go through models of the 8KB instruction and 4KB data caches.
+	// Hits take one cycle and never reach the bus, misses first fill the whole line with eight bus reads. The data cache
+	// is write-through: stores still go to the bus and update the line if it's cached, but never allocate one. So
+	// cleaning is a no-op, the c7 invalidate and prefetch operations are done after MCRs. Lockdown (c9,c0) isn't modeled.
+	CacheModel<0x2000> instructionCache;
+	CacheModel<0x1000> dataCache;
+
+	bool instructionCacheable(u32 address) {
+		return cp15.instructionCacheEnable && (cp15.protectionMap[address >> 12] & cp15.PROTECTION_INSTRUCTION_CACHEABLE);
+	}
+
+	bool dataCacheable(u32 address) {
+		return cp15.dataCacheEnable && (cp15.protectionMap[address >> 12] & cp15.PROTECTION_DATA_CACHEABLE);
+	}
+
+	template <bool code, typename Cache> u8 *cacheLine(Cache& cache, u32 address) {
+		if (u8 *line = cache.find(address)) [[likely]] {
+			coreSpeedCycles();
+			return line;
+		}
+
+		flushPendingCycles();
+		u8 *line = cache.allocate(address, cp15.cacheReplacement);
+		u32 lineAddress = address & ~0x1F;
+		for (int i = 0; i < 8; i++) {
+			accessCycles<u32>(lineAddress + (i * 4), i != 0);
+			u32 value = bus.template read<u32, code>(lineAddress + (i * 4), i != 0);
+			memcpy(line + (i * 4), &value, sizeof(u32));
+		}
+		return line;
+	}
+
+	void cacheOperation(u32 copOpReg, u32 copOpcType, u32 value) {
+		switch ((copOpReg << 3) | copOpcType) {
+		case (5 << 3) | 0: // Invalidate instruction cache
+			instructionCache.invalidate();
+			break;
+		case (5 << 3) | 1: // Invalidate instruction cache line
+			instructionCache.invalidateLine(value);
+			break;
+		case (6 << 3) | 0: // Invalidate data cache
+			dataCache.invalidate();
+			break;
+		case (6 << 3) | 1: // Invalidate data cache line
+		case (14 << 3) | 1: // Clean and invalidate data cache line
+			dataCache.invalidateLine(value);
+			break;
+		case (14 << 3) | 2: // Clean and invalidate data cache line by set/way
+			dataCache.invalidateIndex(value);
+			break;
+		case (13 << 3) | 1: // Prefetch instruction cache line
+			if (instructionCacheable(value))
+				cacheLine<true>(instructionCache, value);
+			break;
+		}
+	}
+#endif
+
+#ifdef ARM946E_FASTMEM
+	/* Fastmem */
+	// Page table of host memory the bus has registered with mapMemory(). Loads and stores that hit a mapped page are
+	// served here and timed from the page's AccessTiming, everything else still goes to the bus.
+	static constexpr u32 FASTMEM_PAGE_BITS = 12;
+	static constexpr u32 FASTMEM_PAGE_SIZE = 1 << FASTMEM_PAGE_BITS;
+	static constexpr u32 FASTMEM_PAGE_MASK = FASTMEM_PAGE_SIZE - 1;
+
+	struct FastmemPage {
+		u8 *read; // Host memory backing the page, nullptr if reads go to the bus
+		u8 *write;
+		AccessTiming timing;
+	};
+	// First level covers 1MB per entry and is only filled in where something is mapped
+	std::array<std::unique_ptr<std::array<FastmemPage, 256>>, 4096> fastmemTable;
+
+	// start and size must be multiples of FASTMEM_PAGE_SIZE. memory has to stay valid until the range is unmapped
+	// or mapped again, so bank switches and mirrors just call this again with the new host pointer.
+	void mapMemory(u32 start, u32 size, u8 *memory, bool writable, AccessTiming timing) {
+		for (u32 offset = 0; offset < size; offset += FASTMEM_PAGE_SIZE) {
+			u32 address = start + offset;
+			auto& pages = fastmemTable[address >> 20];
+			if (!pages)
+				pages = std::make_unique<std::array<FastmemPage, 256>>();
+
+			FastmemPage& page = (*pages)[(address >> FASTMEM_PAGE_BITS) & 0xFF];
+			page.read = memory + offset;
+			page.write = writable ? (memory + offset) : nullptr;
+			page.timing = timing;
+		}
+	}
+
+	// Sends accesses in the range back to the bus
+	void unmapMemory(u32 start, u32 size) {
+		for (u32 offset = 0; offset < size; offset += FASTMEM_PAGE_SIZE) {
+			u32 address = start + offset;
+			if (auto& pages = fastmemTable[address >> 20])
+				(*pages)[(address >> FASTMEM_PAGE_BITS) & 0xFF] = {};
+		}
+	}
+#endif
 };
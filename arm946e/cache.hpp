@@ -0,0 +1,104 @@
+#pragma once
+
+#include "../types.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// 4-way set associative cache with 32 byte lines, used by ARM946E for its 8KB instruction and 4KB data caches.
+// The tags of a set sit next to each other apart from the line data, so a lookup is one 128-bit compare.
+// A tag is the line address with bit 0 set, so an empty way (0) never matches.
+template <std::size_t size>
+class CacheModel {
+public:
+	static constexpr std::size_t LINE_SIZE = 32;
+	static constexpr std::size_t WAYS = 4;
+	static constexpr std::size_t SETS = size / (LINE_SIZE * WAYS);
+	static constexpr u32 LINE_MASK = LINE_SIZE - 1;
+
+	CacheModel() {
+		invalidate();
+		victim = 0;
+		lfsr = 1;
+	}
+
+	// Returns the line holding address, or nullptr on a miss
+	u8 *find(u32 address) {
+		u32 tag = (address & ~LINE_MASK) | 1;
+		if (tag == lastTag) [[likely]] // Sequential accesses mostly stay in the same line
+			return lastLine;
+
+		u32 set = (address / LINE_SIZE) & (SETS - 1);
+		int way = findWay(set, tag);
+		if (way < 0)
+			return nullptr;
+
+		lastTag = tag;
+		lastLine = lines[set][way];
+		return lastLine;
+	}
+
+	// Evicts a line of the set address maps to and gives it to address. The caller fills in the data.
+	u8 *allocate(u32 address, bool roundRobin) {
+		u32 set = (address / LINE_SIZE) & (SETS - 1);
+		int way;
+		if (roundRobin) {
+			way = victim;
+			victim = (victim + 1) & (WAYS - 1);
+		} else {
+			lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xB400);
+			way = lfsr & (WAYS - 1);
+		}
+
+		tags[set][way] = (address & ~LINE_MASK) | 1;
+		lastTag = tags[set][way];
+		lastLine = lines[set][way];
+		return lastLine;
+	}
+
+	void invalidate() {
+		memset(tags, 0, sizeof(tags));
+		lastTag = 0;
+	}
+
+	void invalidateLine(u32 address) {
+		u32 set = (address / LINE_SIZE) & (SETS - 1);
+		int way = findWay(set, (address & ~LINE_MASK) | 1);
+		if (way >= 0)
+			invalidateWay(set, way);
+	}
+
+	// Set/way format of the c7 index operations
+	void invalidateIndex(u32 value) {
+		invalidateWay((value / LINE_SIZE) & (SETS - 1), value >> 30);
+	}
+
+private:
+	alignas(16) u32 tags[SETS][WAYS];
+	u8 lines[SETS][WAYS][LINE_SIZE];
+	u32 lastTag;
+	u8 *lastLine;
+	u32 victim;
+	u32 lfsr;
+
+	int findWay(u32 set, u32 tag) {
+#if defined(__SSE2__)
+		__m128i compare = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *)tags[set]), _mm_set1_epi32(tag));
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(compare));
+		return mask ? std::countr_zero((u32)mask) : -1;
+#else
+		for (int way = 0; way < (int)WAYS; way++) {
+			if (tags[set][way] == tag)
+				return way;
+		}
+		return -1;
+#endif
+	}
+
+	void invalidateWay(u32 set, int way) {
+		if (tags[set][way] == lastTag)
+			lastTag = 0;
+		tags[set][way] = 0;
+	}
+};
@@ -7,9 +7,20 @@ public:
 	u8 *dtcm;
 	u8 *itcm;
 
-	SystemControlCoprocessor() {
+	SystemControlCoprocessor(bool& halted) : halted(halted) {
 		dtcm = new u8[0x4000]; // 16KB
 		itcm = new u8[0x8000]; // 32KB
+
+		dtcmConfig = 0;
+		itcmConfig = 0;
+		for (auto& region : protectionRegions)
+			region.raw = 0;
+		dataCacheable = 0;
+		instructionCacheable = 0;
+		writeBufferable = 0;
+		dataPermissions = 0;
+		instructionPermissions = 0;
+		compiledEnable = false;
 	}
 
 	void reset() {
@@ -25,6 +36,37 @@ public:
 		delete[] itcm;
 	}
 
+	// Copies every register and the TCM contents, for ARM946E::loadState()
+	void loadState(const SystemControlCoprocessor& other) {
+		memcpy(dtcm, other.dtcm, 0x4000);
+		memcpy(itcm, other.itcm, 0x8000);
+
+		control = other.control;
+		dtcmConfig = other.dtcmConfig;
+		itcmConfig = other.itcmConfig;
+		dtcmStart = other.dtcmStart;
+		dtcmEnd = other.dtcmEnd;
+		itcmEnd = other.itcmEnd;
+		itcmReadable = other.itcmReadable;
+		itcmWritable = other.itcmWritable;
+		dtcmReadable = other.dtcmReadable;
+		dtcmWritable = other.dtcmWritable;
+
+		for (int i = 0; i < 8; i++)
+			protectionRegions[i] = other.protectionRegions[i];
+		dataCacheable = other.dataCacheable;
+		instructionCacheable = other.instructionCacheable;
+		writeBufferable = other.writeBufferable;
+		dataPermissions = other.dataPermissions;
+		instructionPermissions = other.instructionPermissions;
+		protectionMap = other.protectionMap;
+		for (int i = 0; i < 8; i++)
+			compiledRegions[i] = other.compiledRegions[i];
+		compiledEnable = other.compiledEnable;
+
+		halted = other.halted;
+	}
+
 	// Registers
 	union {
 		struct {
@@ -71,9 +113,213 @@ public:
 		u32 itcmConfig; // c9,c1,1
 	};
 
+	// Decoded TCM windows, ends are exclusive. ITCM always starts at 0.
 	u32 dtcmStart;
 	u32 dtcmEnd;
 	u32 itcmEnd;
+	bool itcmReadable;
+	bool itcmWritable;
+	bool dtcmReadable;
+	bool dtcmWritable;
+
+	// Has to be called after control, c9,c1,0 or c9,c1,1 change. ARM946E does it after MCRs to c1 and c9.
+	void updateTcmRegions() {
+		dtcmStart = dtcmRegionBase << 12;
+		dtcmEnd = dtcmStart + tcmSize(dtcmVirtualSize);
+		itcmEnd = tcmSize(itcmVirtualSize);
+
+		// Write-only (load) mode sends reads to the bus
+		itcmWritable = itcmEnable;
+		itcmReadable = itcmEnable && !itcmWriteOnly;
+		dtcmWritable = dtcmEnable;
+		dtcmReadable = dtcmEnable && !dtcmWriteOnly;
+	}
+
+	// Protection regions, size is 2^(size + 1) bytes and the base is aligned to it
+	union ProtectionRegion {
+		struct {
+			u32 enable : 1;
+			u32 size : 5;
+			u32 : 6;
+			u32 base : 20;
+		};
+		u32 raw;
+	};
+	ProtectionRegion protectionRegions[8]; // c6,c0-c7,0
+	u32 dataCacheable; // c2,c0,0
+	u32 instructionCacheable; // c2,c0,1
+	u32 writeBufferable; // c3,c0,0
+	u32 dataPermissions; // c5,c0,2 (4 bits per region, c5,c0,0 is the 2 bit view)
+	u32 instructionPermissions; // c5,c0,3 (c5,c0,1)
+
+	// For the bus's coprocessorRead()/coprocessorWrite(), return false if the register isn't an MPU one
+	bool readProtectionRegister(u32 copSrcDestReg, u32 copOpReg, u32 copOpcType, u32& value) {
+		switch (copSrcDestReg) {
+		case 2:
+			if ((copOpReg != 0) || (copOpcType > 1))
+				return false;
+			value = copOpcType ? instructionCacheable : dataCacheable;
+			return true;
+		case 3:
+			if ((copOpReg != 0) || (copOpcType != 0))
+				return false;
+			value = writeBufferable;
+			return true;
+		case 5:
+			if ((copOpReg != 0) || (copOpcType > 3))
+				return false;
+			value = (copOpcType & 1) ? instructionPermissions : dataPermissions;
+			if (copOpcType < 2)
+				value = compactPermissions(value);
+			return true;
+		case 6:
+			if (copOpcType != 0)
+				return false;
+			value = protectionRegions[copOpReg & 7].raw;
+			return true;
+		}
+		return false;
+	}
+
+	bool writeProtectionRegister(u32 copSrcDestReg, u32 copOpReg, u32 copOpcType, u32 value) {
+		switch (copSrcDestReg) {
+		case 2:
+			if ((copOpReg != 0) || (copOpcType > 1))
+				return false;
+			(copOpcType ? instructionCacheable : dataCacheable) = value & 0xFF;
+			return true;
+		case 3:
+			if ((copOpReg != 0) || (copOpcType != 0))
+				return false;
+			writeBufferable = value & 0xFF;
+			return true;
+		case 5:
+			if ((copOpReg != 0) || (copOpcType > 3))
+				return false;
+			if (copOpcType < 2)
+				value = expandPermissions(value);
+			((copOpcType & 1) ? instructionPermissions : dataPermissions) = value;
+			return true;
+		case 6:
+			if (copOpcType != 0)
+				return false;
+			protectionRegions[copOpReg & 7].raw = value & 0xFFFFF03F;
+			return true;
+		}
+		return false;
+	}
+
+	// One byte per 4KB page. The low nibble applies to privileged modes, the high one to user mode, except for the
+	// cacheable bits.
+	enum protectionFlags : u8 {
+		PROTECTION_READ = 1 << 0,
+		PROTECTION_WRITE = 1 << 1,
+		PROTECTION_EXECUTE = 1 << 2,
+		PROTECTION_DATA_CACHEABLE = 1 << 3,
+		PROTECTION_INSTRUCTION_CACHEABLE = 1 << 7
+	};
+	static constexpr int PROTECTION_USER_SHIFT = 4;
+	std::vector<u8> protectionMap;
+
+	// The pages and flags each region was last compiled with, disabled regions cover no pages
+	struct CompiledRegion {
+		u32 firstPage;
+		u32 pages;
+		u8 flags;
 
-	bool halted;
+		bool operator==(const CompiledRegion& other) const = default;
+	};
+	CompiledRegion compiledRegions[8];
+	bool compiledEnable;
+
+	// Has to be called after control, c2, c3, c5 or c6 change. ARM946E does it after MCRs to them with ARM946E_MPU set.
+	// Compiling the regions here keeps permission checks down to one lookup. Only the pages of regions that changed
+	// since the last call are compiled again, so MCRs that leave the regions alone cost eight compares.
+	void updateProtectionMap() {
+		if (protectionMap.empty() || (compiledEnable != (bool)puEnable)) {
+			protectionMap.resize(1 << 20);
+			compiledEnable = puEnable;
+			if (!puEnable) {
+				std::fill(protectionMap.begin(), protectionMap.end(), (u8)0x77);
+				return;
+			}
+
+			for (int i = 0; i < 8; i++)
+				compiledRegions[i] = compileRegion(i);
+			compilePages(0, 1 << 20);
+			return;
+		}
+		if (!puEnable)
+			return;
+
+		for (int i = 0; i < 8; i++) {
+			CompiledRegion region = compileRegion(i);
+			if (region == compiledRegions[i]) [[likely]]
+				continue;
+
+			CompiledRegion old = compiledRegions[i];
+			compiledRegions[i] = region;
+			compilePages(old.firstPage, old.pages);
+			compilePages(region.firstPage, region.pages);
+		}
+	}
+
+	CompiledRegion compileRegion(int i) {
+		const ProtectionRegion& region = protectionRegions[i];
+		if (!region.enable)
+			return {0, 0, 0};
+
+		u32 pages = 1 << (std::max<u32>(region.size, 11) - 11); // 4KB at least
+		u8 data = accessFlags(dataPermissions >> (i * 4));
+		u8 code = accessFlags(instructionPermissions >> (i * 4)) & 0x11;
+		u8 flags = (data & 0x33) | (code << 2);
+		if (dataCacheable & (1 << i))
+			flags |= PROTECTION_DATA_CACHEABLE;
+		if (instructionCacheable & (1 << i))
+			flags |= PROTECTION_INSTRUCTION_CACHEABLE;
+		return {region.base & ~(pages - 1), pages, flags};
+	}
+
+	// Fills pages [first, first + count) from compiledRegions
+	void compilePages(u32 first, u32 count) {
+		std::fill_n(protectionMap.begin() + first, count, (u8)0); // Background region
+		for (const auto& region : compiledRegions) { // Higher numbered regions take priority
+			u32 start = std::max(first, region.firstPage);
+			u32 end = std::min(first + count, region.firstPage + region.pages);
+			if (start < end)
+				std::fill_n(protectionMap.begin() + start, end - start, region.flags);
+		}
+	}
+
+	bool& halted; // Wait for interrupt, set by the bus. Belongs to the core so it can be checked with its other pending work
+
+	// Read and write bits for both privilege levels
+	static u8 accessFlags(u32 permissions) {
+		switch (permissions & 0xF) {
+		case 1: return PROTECTION_READ | PROTECTION_WRITE;
+		case 2: return (PROTECTION_READ | PROTECTION_WRITE) | (PROTECTION_READ << PROTECTION_USER_SHIFT);
+		case 3: return (PROTECTION_READ | PROTECTION_WRITE) * 0x11;
+		case 5: return PROTECTION_READ;
+		case 6: return PROTECTION_READ * 0x11;
+		default: return 0; // No access or reserved
+		}
+	}
+
+	static u32 expandPermissions(u32 value) {
+		u32 result = 0;
+		for (int i = 0; i < 8; i++)
+			result |= ((value >> (i * 2)) & 3) << (i * 4);
+		return result;
+	}
+
+	static u32 compactPermissions(u32 value) {
+		u32 result = 0;
+		for (int i = 0; i < 8; i++)
+			result |= ((value >> (i * 4)) & 3) << (i * 2);
+		return result;
+	}
+
+	static u32 tcmSize(u32 virtualSize) {
+		return (virtualSize >= 23) ? 0xFFFFFFFF : (512u << virtualSize);
+	}
 };
@@ -0,0 +1,44 @@
+// Creates many cores on one bus and prints the time and resident memory each one takes, for hosts that run lots of
+// instances (test farms, multi-system emulators). Cores that never run should cost little more than their object.
+#include "../arm7tdmi/arm7tdmi.hpp"
+#include "../arm946e/arm946e.hpp"
+#include "../bus/flatmemorybus.hpp"
+
+#include <chrono>
+#include <cstdio>
+
+static constexpr int INSTANCES = 200;
+
+// Resident set size in KB, from /proc/self/statm
+static long residentKB() {
+	long size = 0, resident = 0;
+	if (FILE *file = fopen("/proc/self/statm", "r")) {
+		if (fscanf(file, "%ld %ld", &size, &resident) != 2)
+			resident = 0;
+		fclose(file);
+	}
+	return resident * 4;
+}
+
+template <typename Core> void bench(const char *name) {
+	FlatMemoryBus bus(0x1000);
+	std::vector<std::unique_ptr<Core>> cores;
+	cores.reserve(INSTANCES);
+
+	long startKB = residentKB();
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < INSTANCES; i++)
+		cores.push_back(std::make_unique<Core>(bus));
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	long endKB = residentKB();
+
+	printf("%s\n", name);
+	printf("  object size   %7zu bytes\n", sizeof(Core));
+	printf("  construction  %7.2f us/instance\n", seconds * 1e6 / INSTANCES);
+	printf("  resident      %7ld KB/instance\n", (endKB - startKB) / INSTANCES);
+}
+
+int main() {
+	bench<ARM7TDMI<FlatMemoryBus>>("ARM7TDMI");
+	bench<ARM946E<FlatMemoryBus>>("ARM946E");
+}
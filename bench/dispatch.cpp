@@ -0,0 +1,67 @@
+// Runs the same loop through every way of driving a core and prints the time per instruction
+#include "../arm7tdmi/arm7tdmi.hpp"
+#include "../arm946e/arm946e.hpp"
+#include "../bus/flatmemorybus.hpp"
+
+#include <chrono>
+#include <cstdio>
+
+// add r0, r0, #1; subs r1, r1, #1; bne 0; b .
+static const u32 program[] = {0xE2800001, 0xE2511001, 0x1AFFFFFC, 0xEAFFFFFE};
+static constexpr u32 ITERATIONS = 10000000;
+static constexpr double INSTRUCTIONS = ITERATIONS * 3.0;
+static constexpr int REPEATS = 5;
+
+static bool failed = false; // Makes main() return nonzero so "make run" fails
+
+template <typename Core> void restart(Core& cpu) {
+	if constexpr (requires { cpu.resetARM946E(); }) {
+		cpu.resetARM946E();
+		cpu.cp15.control = 0x10079; // Exception vectors at 0
+	} else {
+		cpu.resetARM7TDMI();
+	}
+	cpu.reg.R[1] = ITERATIONS;
+	cpu.reg.R[15] = 0;
+	cpu.flushPipeline();
+}
+
+template <typename Core, typename Run> double measure(Core& cpu, Run run) {
+	double best = 1e30;
+	for (int i = 0; i < REPEATS; i++) {
+		restart(cpu);
+		auto start = std::chrono::steady_clock::now();
+		run();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (cpu.reg.R[0] != ITERATIONS) {
+			printf("  wrong result, r0 = %u\n", cpu.reg.R[0]);
+			failed = true;
+		}
+		best = std::min(best, seconds);
+	}
+	return best * 1e9 / INSTRUCTIONS;
+}
+
+template <typename Core> void bench(const char *name) {
+	FlatMemoryBus bus;
+	bus.load(0, program, sizeof(program));
+	auto cpu = std::make_unique<Core>(bus);
+
+	// The cycles the loop takes, so runFor() stops right where the others do
+	restart(*cpu);
+	u64 start = cpu->currentCycle();
+	while (cpu->reg.R[1])
+		cpu->cycle();
+	u64 loopCycles = cpu->currentCycle() - start;
+
+	printf("%s\n", name);
+	printf("  cycle() loop  %6.2f ns/instruction\n", measure(*cpu, [&]() { while (cpu->reg.R[1]) cpu->cycle(); }));
+	printf("  runUntil()    %6.2f ns/instruction\n", measure(*cpu, [&]() { cpu->runUntil([&]() { return cpu->reg.R[1] == 0; }); }));
+	printf("  runFor()      %6.2f ns/instruction\n", measure(*cpu, [&]() { cpu->runFor(loopCycles); }));
+}
+
+int main() {
+	bench<ARM7TDMI<FlatMemoryBus>>("ARM7TDMI");
+	bench<ARM946E<FlatMemoryBus>>("ARM946E");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+// Checks that code modifying itself is picked up by every way of driving a core, from RAM and (with
+// ARM946E_INLINE_TCM) from ITCM, then times stores to data pages and to pages code was fetched from. The Makefile
+// builds it with and without *_SMC_CHECK, so the difference is what the check costs on the write path.
+#include "../arm7tdmi/arm7tdmi.hpp"
+#include "../arm946e/arm946e.hpp"
+#include "../bus/flatmemorybus.hpp"
+
+#include <chrono>
+#include <cstdio>
+
+// Calls func, then adds 1 to the immediate of its first instruction, r1 times. So r4 ends up as 1 + 2 + ... + r1.
+//   mov r4, #0; mov r6, #0x100
+//   loop: bl func; ldr r0, [r6]; add r0, r0, #1; str r0, [r6]; subs r1, r1, #1; bne loop; b .
+//   func (0x100): add r4, r4, #1; mov pc, lr
+static const u32 selfModifying[] = {0xE3A04000, 0xE3A06C01, 0xEB00003C, 0xE5960000, 0xE2800001, 0xE5860000, 0xE2511001, 0x1AFFFFF9, 0xEAFFFFFE};
+static const u32 func[] = {0xE2844001, 0xE1A0F00E};
+static constexpr u32 FUNC_ADDRESS = 0x100;
+static constexpr u32 CALLS = 200; // The immediate can't go past 255
+static constexpr u32 EXPECTED = CALLS * (CALLS + 1) / 2;
+
+// w: str r0, [r2]; subs r1, r1, #1; bne w; b .
+static const u32 storeLoop[] = {0xE5820000, 0xE2511001, 0x1AFFFFFC, 0xEAFFFFFE};
+static constexpr u32 DATA_ADDRESS = 0x8000; // A page no code was fetched from
+static constexpr u32 CODE_ADDRESS = 0x800; // Same page as the loop, but never executed
+static constexpr u32 STORES = 1000000;
+static constexpr int REPEATS = 5;
+
+static bool failed = false; // Makes main() return nonzero so "make run" fails
+
+enum class Memory { RAM, ITCM };
+
+template <typename Core> void restart(Core& cpu, FlatMemoryBus& bus, Memory memory, const u32 *program, std::size_t size) {
+	bus.memory.assign(bus.memory.size(), 0);
+	if constexpr (requires { cpu.resetARM946E(); }) {
+		cpu.resetARM946E();
+		if (memory == Memory::ITCM) {
+			cpu.cp15.control = 0x40078; // ITCM on, exception vectors at 0
+			cpu.cp15.itcmConfig = 6 << 1; // 32KB
+		} else {
+			cpu.cp15.control = 0x00078; // No DTCM over the code
+		}
+		cpu.cp15.updateTcmRegions();
+		if (memory == Memory::ITCM) {
+			memcpy(cpu.cp15.itcm, program, size);
+		} else {
+			bus.load(0, program, size);
+		}
+	} else {
+		cpu.resetARM7TDMI();
+		bus.load(0, program, size);
+	}
+	cpu.reg.R[15] = 0;
+	cpu.flushPipeline();
+}
+
+template <typename Core, typename Run> void check(const char *name, Core& cpu, FlatMemoryBus& bus, Memory memory, Run run) {
+	restart(cpu, bus, memory, selfModifying, sizeof(selfModifying));
+	if (memory == Memory::ITCM) {
+		if constexpr (requires { cpu.cp15; })
+			memcpy(cpu.cp15.itcm + FUNC_ADDRESS, func, sizeof(func));
+	} else {
+		bus.load(FUNC_ADDRESS, func, sizeof(func));
+	}
+	cpu.reg.R[1] = CALLS;
+	run();
+	bool ok = cpu.reg.R[4] == EXPECTED;
+	failed |= !ok;
+	printf("  %-12s %s\n", name, ok ? "ok" : "wrong result");
+}
+
+template <typename Core> double measureStores(Core& cpu, FlatMemoryBus& bus, u32 target) {
+	double best = 1e30;
+	for (int i = 0; i < REPEATS; i++) {
+		restart(cpu, bus, Memory::RAM, storeLoop, sizeof(storeLoop));
+		cpu.reg.R[1] = STORES;
+		cpu.reg.R[2] = target;
+		auto start = std::chrono::steady_clock::now();
+		while (cpu.reg.R[1])
+			cpu.cycle();
+		best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	return best * 1e9 / STORES;
+}
+
+template <typename Core> void bench(const char *name, bool itcm) {
+	FlatMemoryBus bus;
+	auto cpu = std::make_unique<Core>(bus);
+
+	printf("%s\n", name);
+	for (Memory memory : {Memory::RAM, Memory::ITCM}) {
+		if ((memory == Memory::ITCM) && !itcm)
+			continue;
+		printf(" %s\n", (memory == Memory::ITCM) ? "ITCM" : "RAM");
+		check("cycle()", *cpu, bus, memory, [&]() { while (cpu->reg.R[1]) cpu->cycle(); });
+		check("runUntil()", *cpu, bus, memory, [&]() { cpu->runUntil([&]() { return cpu->reg.R[1] == 0; }); });
+	}
+	printf("  data page stores  %6.2f ns/iteration\n", measureStores(*cpu, bus, DATA_ADDRESS));
+	printf("  code page stores  %6.2f ns/iteration\n", measureStores(*cpu, bus, CODE_ADDRESS));
+}
+
+int main() {
+#ifdef ARM7TDMI_SMC_CHECK
+	printf("SMC check");
+#else
+	printf("No SMC check");
+#endif
+	printf("\n");
+	bench<ARM7TDMI<FlatMemoryBus>>("ARM7TDMI", false);
+#ifdef ARM946E_INLINE_TCM
+	bench<ARM946E<FlatMemoryBus>>("ARM946E", true);
+#else
+	bench<ARM946E<FlatMemoryBus>>("ARM946E", false);
+#endif
+	return failed ? 1 : 0;
+}
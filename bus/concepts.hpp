@@ -0,0 +1,42 @@
+#pragma once
+
+#include "../types.hpp"
+
+#include <concepts>
+#include <string>
+
+// Interface the cores need from their T& bus. The cores check it with a static_assert in their constructors,
+// so a bus that holds the core as a member can still be declared before it is complete.
+template <typename T>
+concept ARM7TDMIBus = requires (T& bus, u32 address, bool sequential, int cycles) {
+	// Code fetches use code = true, sequential is false for the first access after a jump or a data access
+	{ bus.template read<u8, false>(address, sequential) } -> std::convertible_to<u8>;
+	{ bus.template read<u16, false>(address, sequential) } -> std::convertible_to<u16>;
+	{ bus.template read<u32, false>(address, sequential) } -> std::convertible_to<u32>;
+	{ bus.template read<u16, true>(address, sequential) } -> std::convertible_to<u16>;
+	{ bus.template read<u32, true>(address, sequential) } -> std::convertible_to<u32>;
+	bus.template write<u8>(address, (u8)0, sequential);
+	bus.template write<u16>(address, (u16)0, sequential);
+	bus.template write<u32>(address, (u32)0, sequential);
+
+	bus.iCycle(cycles); // Internal cycles
+	bus.breakpoint(); // Called before executing an instruction that has a breakpoint
+	bus.hacf(); // Called after an unrecoverable error has been written to log
+	bus.log << std::string();
+};
+
+template <typename T>
+concept ARM946EBus = ARM7TDMIBus<T> && requires (T& bus, u32 value) {
+	// Coprocessor number, opcode 1, CRn, CRm, opcode 2 (and the value for writes)
+	{ bus.coprocessorRead(value, value, value, value, value) } -> std::convertible_to<u32>;
+	bus.coprocessorWrite(value, value, value, value, value, value);
+};
+
+// Optional hooks, detected at compile time. A bus that leaves them out pays nothing for them.
+//  u64 cycleCount()                                    Needed by runFor() unless *_LOCAL_CYCLES is set
+//  bool isVolatile(u32 address), void idleLoop(u32 address)  Idle loop detection
+//  bool fetchRegion(u32 address, FetchRegion& region)  Direct opcode fetches from host memory
+//  bool readBlock(u32 address, u32 *values, int count),
+//  bool writeBlock(u32 address, const u32 *values, int count)  LDM/STM/PUSH/POP in one call
+//  void deadlineReached()                              Deadlines with *_LOCAL_CYCLES
+//  void codeModified(u32 address)                      A page code was fetched from was written to
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "../types.hpp"
+#include "concepts.hpp"
+
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+// Minimal bus with a single block of zero-wait RAM mirrored over the whole address space. Every access takes one
+// cycle. It only implements the required interface, so ARM7TDMI<FlatMemoryBus> and ARM946E<FlatMemoryBus> measure
+// the cores' default paths without any emulator's memory map in the way. A read-only ROM image can be mapped over
+// part of it, so many instances running the same program only need one copy.
+// With *_LOCAL_CYCLES the core keeps time instead of cycles, so give it the same timing with
+// setRegionTiming(0, 255, FlatMemoryBus::TIMING).
+class FlatMemoryBus {
+public:
+	static constexpr AccessTiming TIMING = {1, 1, 1, 1};
+
+	// size has to be a power of two
+	FlatMemoryBus(std::size_t size = 0x100000) : memory(size), addressMask(size - 1) {}
+
+	std::vector<u8> memory;
+	u32 addressMask;
+	std::shared_ptr<const std::vector<u8>> rom; // Read-only, can be shared between any number of buses
+	u32 romStart = 0;
+	u32 romSize = 0;
+	u64 cycles = 0;
+	u64 breakpointsHit = 0;
+	bool dead = false;
+	std::stringstream log;
+
+	void load(u32 address, const void *data, std::size_t size) {
+		for (std::size_t i = 0; i < size; i++)
+			memory[(address + i) & addressMask] = ((const u8 *)data)[i];
+	}
+
+	// Maps a ROM image at start instead of copying it into memory. Writes to it are ignored.
+	void mapRom(u32 start, std::shared_ptr<const std::vector<u8>> image) {
+		rom = std::move(image);
+		romStart = start;
+		romSize = rom ? (u32)(rom->size() & ~3) : 0;
+	}
+
+	template <typename T, bool code> T read(u32 address, [[maybe_unused]] bool sequential) {
+		T value;
+		address &= ~(sizeof(T) - 1);
+		cycles++;
+		if ((address - romStart) < romSize) {
+			memcpy(&value, &(*rom)[address - romStart], sizeof(T));
+		} else {
+			memcpy(&value, &memory[address & addressMask], sizeof(T));
+		}
+		return value;
+	}
+
+	template <typename T> void write(u32 address, T value, [[maybe_unused]] bool sequential) {
+		cycles++;
+		if ((address - romStart) >= romSize)
+			memcpy(&memory[address & addressMask & ~(sizeof(T) - 1)], &value, sizeof(T));
+	}
+
+	void iCycle(int count) { cycles += count; }
+	u64 cycleCount() { return cycles; }
+	void breakpoint() { breakpointsHit++; }
+	void hacf() { dead = true; }
+
+	u32 coprocessorRead(u32, u32, u32, u32, u32) { return 0; }
+	void coprocessorWrite(u32, u32, u32, u32, u32, u32) {}
+};
+
+static_assert(ARM946EBus<FlatMemoryBus>);
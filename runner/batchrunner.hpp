@@ -0,0 +1,142 @@
+#pragma once
+
+#include "../types.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Read-only ROM image shared by every instance that maps it. Nothing writes to it after loading, so any number of
+// threads can read it without locking.
+using RomImage = std::shared_ptr<const std::vector<u8>>;
+
+// Returns nullptr if the file can't be read
+inline RomImage loadRomImage(const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return nullptr;
+
+	std::vector<u8> data;
+	u8 buffer[0x10000];
+	std::size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		data.insert(data.end(), buffer, buffer + count);
+	bool failed = ferror(file);
+	fclose(file);
+	if (failed)
+		return nullptr;
+	return std::make_shared<const std::vector<u8>>(std::move(data));
+}
+
+struct BatchResult {
+	bool passed = false;
+	u64 cycles = 0; // Emulated cycles the job ran for
+	std::string message;
+	double seconds = 0; // Host time the job took, filled in by the runner
+};
+
+struct BatchStats {
+	std::size_t jobs = 0;
+	std::size_t passed = 0;
+	std::size_t failed = 0;
+	u64 cycles = 0;
+	double jobSeconds = 0; // Sum of every job's time
+	double wallSeconds = 0; // Time the whole batch took
+	std::size_t slowestJob = 0;
+	std::size_t steals = 0; // Jobs a worker took from another worker's queue
+};
+
+// Runs a list of independent jobs on a pool of threads. Each job builds, runs and throws away its own core and bus,
+// so it gives the same result whatever thread runs it and whatever else is running. The cores' decode tables are
+// static and anything read-only (ROM images) can be shared through RomImage, so all an instance costs is its own
+// state.
+// Jobs are dealt out in contiguous runs, one per worker. A worker takes jobs from the front of its own queue and, once
+// that is empty, steals from the back of the others', so a worker stuck with slow jobs doesn't hold up the batch.
+class BatchRunner {
+public:
+	// 0 threads means one per host CPU
+	BatchRunner(unsigned threads = 0) {
+		threadCount = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// function is called as BatchResult function(const Job& job, std::size_t index) from the worker threads. Results
+	// come back in the same order as jobs.
+	template <typename Job, typename Function> std::vector<BatchResult> run(const std::vector<Job>& jobs, Function&& function) {
+		auto start = std::chrono::steady_clock::now();
+		std::vector<BatchResult> results(jobs.size());
+		unsigned workers = (unsigned)std::min<std::size_t>(threadCount, jobs.size());
+		std::unique_ptr<WorkQueue[]> queues(new WorkQueue[std::max(workers, 1u)]);
+		for (std::size_t i = 0; i < jobs.size(); i++)
+			queues[(i * workers) / jobs.size()].jobs.push_back(i);
+
+		std::vector<std::size_t> steals(workers);
+		auto worker = [&](unsigned self) {
+			std::size_t index;
+			while (takeJob(queues.get(), workers, self, index, steals[self])) {
+				auto jobStart = std::chrono::steady_clock::now();
+				results[index] = function(jobs[index], index);
+				results[index].seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - jobStart).count();
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (unsigned i = 1; i < workers; i++)
+			threads.emplace_back(worker, i);
+		if (workers)
+			worker(0);
+		for (auto& thread : threads)
+			thread.join();
+
+		stats = {};
+		stats.jobs = jobs.size();
+		for (std::size_t i = 0; i < results.size(); i++) {
+			(results[i].passed ? stats.passed : stats.failed)++;
+			stats.cycles += results[i].cycles;
+			stats.jobSeconds += results[i].seconds;
+			if (results[i].seconds > results[stats.slowestJob].seconds)
+				stats.slowestJob = i;
+		}
+		for (std::size_t count : steals)
+			stats.steals += count;
+		stats.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return results;
+	}
+
+	BatchStats stats; // For the last run()
+
+private:
+	unsigned threadCount;
+
+	struct WorkQueue {
+		std::mutex lock;
+		std::deque<std::size_t> jobs;
+	};
+
+	static bool takeJob(WorkQueue *queues, unsigned workers, unsigned self, std::size_t& index, std::size_t& steals) {
+		{
+			std::lock_guard guard(queues[self].lock);
+			if (!queues[self].jobs.empty()) {
+				index = queues[self].jobs.front();
+				queues[self].jobs.pop_front();
+				return true;
+			}
+		}
+
+		// Nothing is ever added once the batch has started, so one empty pass over the others means it's done
+		for (unsigned i = 1; i < workers; i++) {
+			WorkQueue& victim = queues[(self + i) % workers];
+			std::lock_guard guard(victim.lock);
+			if (!victim.jobs.empty()) {
+				index = victim.jobs.back();
+				victim.jobs.pop_back();
+				steals++;
+				return true;
+			}
+		}
+		return false;
+	}
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "../types.hpp"
+
+#include <atomic>
+#include <thread>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Barrier for a fixed number of threads that never takes a lock. Waiters spin for a while, then sleep on the
+// generation counter so an idle thread costs nothing. On a single host CPU spinning only delays the thread being
+// waited for, so waiters go straight to sleep there. The last thread to arrive runs its completion function while
+// everyone else is still waiting, and everything written before arriving is visible to all threads after it.
+class SpinBarrier {
+public:
+	SpinBarrier(u32 count) : count(count), spinLimit((std::thread::hardware_concurrency() > 1) ? SPIN_LIMIT : 0) {}
+
+	template <typename Completion> void arriveAndWait(Completion&& completion) {
+		u32 current = generation.load(std::memory_order_acquire);
+		if ((arrived.fetch_add(1, std::memory_order_acq_rel) + 1) == count) {
+			completion();
+			arrived.store(0, std::memory_order_relaxed);
+			generation.store(current + 1, std::memory_order_release);
+			generation.notify_all();
+			return;
+		}
+
+		for (int spins = 0; generation.load(std::memory_order_acquire) == current; spins++) {
+			if (spins < spinLimit) {
+				pause();
+			} else {
+				generation.wait(current, std::memory_order_acquire);
+			}
+		}
+	}
+
+private:
+	static constexpr int SPIN_LIMIT = 1 << 12;
+	const u32 count;
+	const int spinLimit;
+	alignas(64) std::atomic<u32> arrived = 0;
+	alignas(64) std::atomic<u32> generation = 0;
+
+	static void pause() {
+#if defined(__SSE2__)
+		_mm_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#endif
+	}
+};
+
+// Runs two cores (normally ARM946E and ARM7TDMI) on two host threads: coreA on the thread calling run(), coreB on a
+// worker thread owned by the runner. Each core runs quantumA/quantumB of its own cycles, then both wait at a barrier
+// before starting the next quantum, so neither gets more than one quantum ahead of the other. Each core must have its
+// own bus and anything the buses share must be thread safe.
+//
+// Shared memory rule: a write one core makes during a quantum is only guaranteed to be seen by the other core from
+// the next quantum on. Within a quantum the other core might see it or not, depending on host timing. Buses that need
+// the same results on every run (IPC FIFOs, cross-core interrupts, shared RAM used as a mailbox) should queue those
+// effects while running and apply them in the sync callback. It runs once per quantum, after both cores have stopped
+// and before either starts again, so it can touch both cores and buses freely. A shared Scheduler can be run from
+// there as well. Smaller quanta make cross-core latency shorter but add a barrier wait per quantum.
+template <typename CoreA, typename CoreB>
+class DualCoreRunner {
+public:
+	using SyncCallback = void (*)(void *userData);
+
+	DualCoreRunner(CoreA& coreA, CoreB& coreB, u64 quantumA, u64 quantumB) : coreA(coreA), coreB(coreB), quantumA(quantumA), quantumB(quantumB) {
+		targetA = coreA.currentCycle() + quantumA;
+		targetB = coreB.currentCycle() + quantumB;
+		worker = std::thread([this]() { workerLoop(); });
+	}
+
+	~DualCoreRunner() {
+		shuttingDown = true;
+		barrier.arriveAndWait([this]() { startRun(); });
+		worker.join();
+	}
+
+	void setSyncCallback(SyncCallback callback, void *userData) {
+		syncCallback = callback;
+		syncUserData = userData;
+	}
+
+	// Runs the given number of quanta. Returns false if a core hit a breakpoint or requestExit() was called, in which
+	// case both cores have still finished the current quantum (the one that stopped only up to where it stopped) and
+	// exitA/exitB tell which one it was. Time a core spends halted is skipped as runFor() does.
+	bool run(u64 quanta) {
+		if (quanta == 0)
+			return true;
+
+		requestedQuanta = quanta;
+		barrier.arriveAndWait([this]() { startRun(); }); // Wakes the worker up
+		do {
+			exitA = runQuantum(coreA, targetA);
+			barrier.arriveAndWait([this]() { endQuantum(); });
+		} while (active);
+		return !stopped;
+	}
+
+	// Runs for at least the given number of coreA cycles, in whole quanta
+	bool runFor(u64 cyclesA) {
+		return run((cyclesA + quantumA - 1) / quantumA);
+	}
+
+	typename CoreA::runExitReason exitA = CoreA::EXIT_PREDICATE;
+	typename CoreB::runExitReason exitB = CoreB::EXIT_PREDICATE;
+
+private:
+	CoreA& coreA;
+	CoreB& coreB;
+	const u64 quantumA;
+	const u64 quantumB;
+	u64 targetA; // Where each core's current quantum ends
+	u64 targetB;
+
+	SyncCallback syncCallback = nullptr;
+	void *syncUserData = nullptr;
+
+	// Shared by both threads, the barrier orders every access. The completion function is the one passed by whichever
+	// thread arrives last, so both threads pass the same one.
+	SpinBarrier barrier{2};
+	u64 requestedQuanta = 0;
+	u64 remaining = 0;
+	bool active = false;
+	bool stopped = false;
+	bool shuttingDown = false;
+	std::thread worker;
+
+	// runFor() also returns when an interrupt line changes, so it's called again until the core reaches the end of the
+	// quantum. Only breakpoints and requestExit() end a quantum early. EXIT_HALTED means the core slept until the end.
+	template <typename Core> static typename Core::runExitReason runQuantum(Core& core, u64 target) {
+		for (u64 now = core.currentCycle(); now < target; now = core.currentCycle()) {
+			typename Core::runExitReason reason = core.runFor(target - now);
+			if ((reason == Core::EXIT_BREAKPOINT) || (reason == Core::EXIT_REQUESTED) || (reason == Core::EXIT_HALTED))
+				return reason;
+		}
+		return Core::EXIT_PREDICATE;
+	}
+
+	void workerLoop() {
+		while (true) {
+			barrier.arriveAndWait([this]() { startRun(); });
+			if (shuttingDown)
+				return;
+
+			do {
+				exitB = runQuantum(coreB, targetB);
+				barrier.arriveAndWait([this]() { endQuantum(); });
+			} while (active);
+		}
+	}
+
+	// active can't be set by run() itself, the worker might not have seen the end of the last run() yet
+	void startRun() {
+		remaining = requestedQuanta;
+		stopped = false;
+		active = true;
+	}
+
+	// Runs with both threads parked at the barrier
+	void endQuantum() {
+		if (syncCallback)
+			syncCallback(syncUserData);
+
+		// Quanta end at fixed points, so cores that overshoot one don't drift apart
+		targetA += quantumA;
+		targetB += quantumB;
+		stopped = (exitA == CoreA::EXIT_BREAKPOINT) || (exitA == CoreA::EXIT_REQUESTED) || (exitB == CoreB::EXIT_BREAKPOINT) || (exitB == CoreB::EXIT_REQUESTED);
+		active = !stopped && (--remaining > 0);
+	}
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "../types.hpp"
+
+// Event scheduler for everything the host used to poll between instructions (timers, DMA, video...).
+// Events are registered once with addEvent() and can then be scheduled, rescheduled and cancelled any number of times.
+// Pending events live in a binary min-heap that tracks where each event sits, so all of those are O(log n) and
+// nextEventTime() is a single load. Timestamps use the same clock as the core driving it (see runScheduled()).
+class Scheduler {
+public:
+	using Callback = void (*)(void *userData, u64 lateBy); // lateBy is how far past its timestamp the event ran
+	using EventId = u32;
+	static constexpr u64 NEVER = ~(u64)0;
+
+	EventId addEvent(Callback callback, void *userData) {
+		events.push_back({callback, userData, 0, NOT_SCHEDULED});
+		return (EventId)(events.size() - 1);
+	}
+
+	// Reschedules the event if it is already pending
+	void schedule(EventId id, u64 timestamp) {
+		Event& event = events[id];
+		event.timestamp = timestamp;
+		if (event.heapIndex == NOT_SCHEDULED) {
+			event.heapIndex = (u32)heap.size();
+			heap.push_back(id);
+			siftUp(event.heapIndex);
+		} else {
+			siftUp(event.heapIndex);
+			siftDown(events[id].heapIndex);
+		}
+	}
+
+	void scheduleIn(EventId id, u64 delay) {
+		schedule(id, currentTime + delay);
+	}
+
+	void cancel(EventId id) {
+		u32 index = events[id].heapIndex;
+		if (index == NOT_SCHEDULED)
+			return;
+
+		events[id].heapIndex = NOT_SCHEDULED;
+		EventId last = heap.back();
+		heap.pop_back();
+		if (index < heap.size()) {
+			heap[index] = last;
+			events[last].heapIndex = index;
+			siftUp(index);
+			siftDown(events[last].heapIndex);
+		}
+	}
+
+	bool isScheduled(EventId id) {
+		return events[id].heapIndex != NOT_SCHEDULED;
+	}
+
+	u64 eventTime(EventId id) {
+		return events[id].timestamp;
+	}
+
+	u64 nextEventTime() {
+		return heap.empty() ? NEVER : events[heap[0]].timestamp;
+	}
+
+	// Moves the clock to now and runs every event due by then, earliest first. Callbacks may schedule or cancel
+	// anything, including events that are due right away.
+	void runEvents(u64 now) {
+		currentTime = now;
+		while (!heap.empty() && (events[heap[0]].timestamp <= now)) {
+			EventId id = heap[0];
+			Event event = events[id]; // Copied, the callback might add events
+			cancel(id);
+			event.callback(event.userData, now - event.timestamp);
+		}
+	}
+
+	u64 currentTime = 0; // As of the last runEvents()
+
+private:
+	static constexpr u32 NOT_SCHEDULED = ~(u32)0;
+
+	struct Event {
+		Callback callback;
+		void *userData;
+		u64 timestamp;
+		u32 heapIndex;
+	};
+	std::vector<Event> events;
+	std::vector<EventId> heap;
+
+	void swapEntries(u32 a, u32 b) {
+		std::swap(heap[a], heap[b]);
+		events[heap[a]].heapIndex = a;
+		events[heap[b]].heapIndex = b;
+	}
+
+	void siftUp(u32 index) {
+		while (index > 0) {
+			u32 parent = (index - 1) / 2;
+			if (events[heap[parent]].timestamp <= events[heap[index]].timestamp)
+				break;
+			swapEntries(index, parent);
+			index = parent;
+		}
+	}
+
+	void siftDown(u32 index) {
+		while (true) {
+			u32 smallest = index;
+			u32 left = (index * 2) + 1;
+			u32 right = left + 1;
+			if ((left < heap.size()) && (events[heap[left]].timestamp < events[heap[smallest]].timestamp))
+				smallest = left;
+			if ((right < heap.size()) && (events[heap[right]].timestamp < events[heap[smallest]].timestamp))
+				smallest = right;
+			if (smallest == index)
+				break;
+			swapEntries(index, smallest);
+			index = smallest;
+		}
+	}
+};
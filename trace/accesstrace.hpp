@@ -0,0 +1,122 @@
+#pragma once
+
+#include "../types.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+
+// Binary record of one data access, written to trace files as is (host byte order)
+struct AccessRecord {
+	u64 cycle; // 0 if the core has no way to know it
+	u32 address;
+	u32 value;
+	u32 pc; // Address of the instruction that made the access
+	u8 size; // In bytes
+	u8 write;
+	u16 reserved;
+};
+static_assert(sizeof(AccessRecord) == 24);
+
+// Single producer, single consumer ring of AccessRecords. The core pushes, one other thread pops. When the ring is
+// full push() waits for the consumer if one is attached, so nothing is lost but the core can't run ahead of the drain.
+// With no consumer attached (e.g. an AccessTraceWriter that couldn't open its file) a full ring drops new records and
+// counts them in dropped() instead of stalling the core forever.
+class AccessTraceRing {
+public:
+	// capacity has to be a power of two
+	AccessTraceRing(std::size_t capacity = 1 << 16) : records(new AccessRecord[capacity]), mask(capacity - 1) {}
+
+	void push(const AccessRecord& record) {
+		u64 position = head.load(std::memory_order_relaxed);
+		while ((position - cachedTail) > mask) {
+			cachedTail = tail.load(std::memory_order_acquire);
+			if ((position - cachedTail) > mask) {
+				if (!consumerAttached.load(std::memory_order_acquire)) {
+					droppedRecords.store(droppedRecords.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+					return;
+				}
+				std::this_thread::yield();
+			}
+		}
+
+		records[position & mask] = record;
+		head.store(position + 1, std::memory_order_release);
+	}
+
+	// Returns the number of records copied to out
+	std::size_t pop(AccessRecord *out, std::size_t maxCount) {
+		u64 position = tail.load(std::memory_order_relaxed);
+		std::size_t count = std::min<u64>(head.load(std::memory_order_acquire) - position, maxCount);
+		for (std::size_t i = 0; i < count; i++)
+			out[i] = records[(position + i) & mask];
+
+		tail.store(position + count, std::memory_order_release);
+		return count;
+	}
+
+	// Called by the consumer when it starts and stops draining the ring
+	void attachConsumer(bool attached) { consumerAttached.store(attached, std::memory_order_release); }
+
+	// Records push() threw away because the ring was full with no consumer attached
+	u64 dropped() { return droppedRecords.load(std::memory_order_relaxed); }
+
+private:
+	std::unique_ptr<AccessRecord[]> records;
+	u64 mask;
+
+	// Each side gets its own cache line
+	alignas(64) std::atomic<u64> head = 0;
+	u64 cachedTail = 0; // Producer's last look at tail
+	std::atomic<u64> droppedRecords = 0;
+	alignas(64) std::atomic<u64> tail = 0;
+	std::atomic<bool> consumerAttached = false;
+};
+
+// Drains a ring into a file on a background thread until it is destroyed. The ring only has a consumer attached while
+// valid() is true, so a writer whose file failed to open leaves the core dropping records rather than waiting.
+class AccessTraceWriter {
+public:
+	AccessTraceWriter(AccessTraceRing& ring, const char *path) : ring(ring) {
+		file = fopen(path, "wb");
+		if (file) {
+			ring.attachConsumer(true);
+			thread = std::thread([this]() { run(); });
+		}
+	}
+
+	~AccessTraceWriter() {
+		if (file) {
+			stopping.store(true, std::memory_order_release);
+			thread.join();
+			ring.attachConsumer(false);
+			fclose(file);
+		}
+	}
+
+	bool valid() { return file != nullptr; }
+
+private:
+	static constexpr std::size_t CHUNK_SIZE = 4096;
+	AccessTraceRing& ring;
+	FILE *file;
+	std::thread thread;
+	std::atomic<bool> stopping = false;
+
+	void run() {
+		std::unique_ptr<AccessRecord[]> chunk(new AccessRecord[CHUNK_SIZE]);
+		while (true) {
+			bool lastPass = stopping.load(std::memory_order_acquire); // Whatever was pushed before the stop still gets written
+			std::size_t count = ring.pop(chunk.get(), CHUNK_SIZE);
+			if (count) {
+				fwrite(chunk.get(), sizeof(AccessRecord), count, file);
+			} else if (lastPass) {
+				break;
+			} else {
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+			}
+		}
+	}
+};
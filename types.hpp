@@ -4,7 +4,9 @@
 #include <algorithm>
 #include <bit>
 #include <bitset>
+#include <concepts>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 #include <vector>
@@ -19,3 +21,31 @@ using i32 = std::int32_t;
 using u32 = std::uint32_t;
 using i64 = std::int64_t;
 using u64 = std::uint64_t;
+
+// Filled in by a bus's optional fetchRegion(u32 address, FetchRegion& region) hook. Describes memory the cores
+// can fetch sequential opcodes from directly instead of going through bus.read().
+struct FetchRegion {
+	const u8 *memory; // Host pointer to the byte at start
+	u32 start;
+	u32 size; // In bytes, must be a multiple of 4. 0 means nothing can be fetched directly.
+	u32 cycles16; // Cost of one sequential halfword fetch
+	u32 cycles32; // Cost of one sequential word fetch
+};
+
+// Cycle costs of a block of memory, for accesses the cores serve without calling the bus.
+// Byte accesses cost the same as halfword accesses.
+struct AccessTiming {
+	u8 nonsequential16;
+	u8 sequential16;
+	u8 nonsequential32;
+	u8 sequential32;
+};
+
+// Mask covering count bytes of a u64 starting at byte first in memory order, for testing bools packed in a union
+// with the u64 (like the cores' pendingWork) the same way on little and big endian hosts.
+constexpr u64 byteMask(int first, int count) {
+	std::array<u8, 8> bytes{};
+	for (int i = first; i < first + count; i++)
+		bytes[i] = 0xFF;
+	return std::bit_cast<u64>(bytes);
+}